@@ -0,0 +1,180 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdatomic.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "connector.h"
+
+//Single-producer/single-consumer rings in shared memory, one per direction: the creating process writes
+//to the first ring and reads from the second, a child forked after the creation does the opposite.
+//Many messages can be in flight, a message is handed over with a release store of the tail and taken
+//with one of the head.
+//Capacity (a power of 2) and message size can be set at build time, e.g. CFLAGS+=-DRING_CAPACITY=4096
+
+#ifndef RING_CAPACITY
+#define RING_CAPACITY 1024 //Slots per direction
+#endif
+#ifndef COMMUNICATION_BUFFER_SIZE
+#define COMMUNICATION_BUFFER_SIZE 80 //Largest message
+#endif
+#define CACHE_LINE 64
+#define RING_SPIN_LIMIT 1024 //Empty or full checks before the process gives the CPU away
+#define RING_WAIT_LIMIT 5 //Seconds to wait for the peer before a read or a write fails
+#define SH_FILE_NAME "/goatring"
+
+_Static_assert(RING_CAPACITY >= 2 && (RING_CAPACITY & (RING_CAPACITY - 1)) == 0, "RING_CAPACITY must be a power of 2");
+
+//Message slot
+struct slot_t
+{
+  size_t size; //Message size
+  char data[COMMUNICATION_BUFFER_SIZE]; //Message
+};
+
+//Ring of one direction, the indices only grow and are reduced modulo the capacity
+struct ring_t
+{
+  _Atomic size_t tail __attribute__((aligned(CACHE_LINE))); //Next slot to write (stored by the producer)
+  _Atomic size_t head __attribute__((aligned(CACHE_LINE))); //Next slot to read (stored by the consumer)
+  struct slot_t slots[RING_CAPACITY] __attribute__((aligned(CACHE_LINE))); //Messages
+};
+
+//Local side of a ring: the own index and the last seen index of the peer, so the shared
+//line of the peer is read only when the ring looks full or empty
+struct ring_end_t
+{
+  struct ring_t* p_ring;
+  size_t position; //Own index (tail of the producer or head of the consumer)
+  size_t peer_position; //Cached index of the peer
+};
+
+static struct ring_t* p_rings = NULL;
+static struct ring_end_t write_end; //Ring this process writes to
+static struct ring_end_t read_end; //Ring this process reads from
+static int file_desc = 0;
+
+//Bind the ends of a process to the rings (the peer gets them swapped)
+static void _bind_ends(int peer)
+{
+  memset(&write_end, 0, sizeof(write_end));
+  memset(&read_end, 0, sizeof(read_end));
+  write_end.p_ring = &p_rings[peer];
+  read_end.p_ring = &p_rings[!peer];
+}
+
+//Forked child is the peer of the creator
+static void _on_fork_child()
+{
+  if (p_rings)
+    _bind_ends(1);
+}
+
+void connector_create()
+{
+  file_desc = shm_open(SH_FILE_NAME, O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (file_desc == -1)
+    return;
+  if (ftruncate(file_desc, 2 * sizeof(struct ring_t)) == -1)
+    return;
+  p_rings = (struct ring_t*)mmap(NULL, 2 * sizeof(struct ring_t), PROT_READ | PROT_WRITE, MAP_SHARED, file_desc, 0);
+  if (p_rings == MAP_FAILED)
+  {
+    p_rings = NULL;
+    return;
+  }
+  atomic_init(&p_rings[0].tail, 0);
+  atomic_init(&p_rings[0].head, 0);
+  atomic_init(&p_rings[1].tail, 0);
+  atomic_init(&p_rings[1].head, 0);
+  _bind_ends(0);
+  if (pthread_atfork(NULL, NULL, _on_fork_child) != 0)
+  {
+    munmap(p_rings, 2 * sizeof(struct ring_t));
+    p_rings = NULL;
+  }
+}
+
+//Wait for the peer: spin first, then yield the CPU (fails after RING_WAIT_LIMIT seconds)
+static int _wait(unsigned* p_spins, time_t* p_deadline)
+{
+  struct timespec ts;
+
+  if (++*p_spins < RING_SPIN_LIMIT)
+    return CONNECTOR_SUCCEEDED;
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+    return CONNECTOR_FAILED;
+  if (*p_deadline == 0)
+    *p_deadline = ts.tv_sec + RING_WAIT_LIMIT;
+  else if (ts.tv_sec >= *p_deadline)
+    return CONNECTOR_FAILED;
+  sched_yield();
+  return CONNECTOR_SUCCEEDED;
+}
+
+int connector_read(void* buffer, size_t size)
+{
+  struct ring_end_t* p_end = &read_end;
+  struct slot_t* p_slot;
+  unsigned spins = 0;
+  time_t deadline = 0;
+  int result;
+
+  if (size > COMMUNICATION_BUFFER_SIZE || !p_rings)
+    return CONNECTOR_FAILED;
+  while (p_end->position == p_end->peer_position)
+  {
+    p_end->peer_position = atomic_load_explicit(&p_end->p_ring->tail, memory_order_acquire);
+    if (p_end->position == p_end->peer_position && _wait(&spins, &deadline) == CONNECTOR_FAILED)
+      return CONNECTOR_FAILED;
+  }
+  p_slot = &p_end->p_ring->slots[p_end->position & (RING_CAPACITY - 1)];
+  result = (p_slot->size >= size) ? CONNECTOR_SUCCEEDED : CONNECTOR_FAILED; //A shorter message is dropped
+  if (result == CONNECTOR_SUCCEEDED)
+    memcpy(buffer, p_slot->data, size);
+  ++p_end->position;
+  atomic_store_explicit(&p_end->p_ring->head, p_end->position, memory_order_release);
+  return result;
+}
+
+int connector_is_created()
+{
+  return p_rings ? CONNECTOR_SUCCEEDED : CONNECTOR_FAILED;
+}
+
+int connector_write(void* buffer, size_t size)
+{
+  struct ring_end_t* p_end = &write_end;
+  struct slot_t* p_slot;
+  unsigned spins = 0;
+  time_t deadline = 0;
+
+  if (size > COMMUNICATION_BUFFER_SIZE || !p_rings)
+    return CONNECTOR_FAILED;
+  while (p_end->position - p_end->peer_position == RING_CAPACITY)
+  {
+    p_end->peer_position = atomic_load_explicit(&p_end->p_ring->head, memory_order_acquire);
+    if (p_end->position - p_end->peer_position == RING_CAPACITY && _wait(&spins, &deadline) == CONNECTOR_FAILED)
+      return CONNECTOR_FAILED;
+  }
+  p_slot = &p_end->p_ring->slots[p_end->position & (RING_CAPACITY - 1)];
+  p_slot->size = size;
+  memcpy(p_slot->data, buffer, size);
+  ++p_end->position;
+  atomic_store_explicit(&p_end->p_ring->tail, p_end->position, memory_order_release);
+  return CONNECTOR_SUCCEEDED;
+}
+
+void connector_destruct()
+{
+  munmap(p_rings, 2 * sizeof(struct ring_t));
+  p_rings = NULL;
+  close(file_desc);
+  shm_unlink(SH_FILE_NAME);
+}
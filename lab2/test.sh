@@ -1,8 +1,8 @@
 #!/bin/bash
-declare -a executables=("host_mmap" "host_shm" "host_mq" "host_pipe" "host_fifo" "host_sock")
+declare -a executables=("host_mmap" "host_shm" "host_mq" "host_pipe" "host_fifo" "host_sock" "host_ring")
 ex_num=${#executables[@]}
-declare -a ex_msg=("Running mmap executable" "Running shared memory executable" "Running message queue executable" "Running pipe executable" "Running fifo executable" "Running sockets executable")
-declare -a ex_out=("tmp1" "tmp2" "tmp3" "tmp4" "tmp5" "tmp6")
+declare -a ex_msg=("Running mmap executable" "Running shared memory executable" "Running message queue executable" "Running pipe executable" "Running fifo executable" "Running sockets executable" "Running shared memory ring executable")
+declare -a ex_out=("tmp1" "tmp2" "tmp3" "tmp4" "tmp5" "tmp6" "tmp7")
 press_enter="Press ENTER to continue"
 press_enter_start="Press ENTER to start"
 
@@ -0,0 +1,685 @@
+
+#ifndef BENCHMARK_QTRZVD__
+#define BENCHMARK_QTRZVD__
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <string>
+#include <ostream>
+#include <iomanip>
+#include <sstream>
+#include <cmath>
+#include <cstdint>
+#include <pthread.h>
+
+#include "set.h"
+#include "perf_counters.hpp"
+#include "set_image.hpp"
+
+//Error messages
+static const char* g_msg_err_benchmark_mix = "Benchmark operation mix must sum to 100";
+static const char* g_msg_err_benchmark_options = "Invalid benchmark options";
+static const char* g_msg_err_benchmark_threads = "Benchmark threads creation error";
+static const char* g_msg_err_benchmark_image = "Benchmark set image can not be saved or opened";
+
+//Latency histogram with log-linear buckets (16 buckets per power of two, relative error below 1/16)
+class LatencyHistogram
+{
+public:
+  static const size_t SUB_BUCKETS = 16; //Buckets per power of two
+  static const size_t BUCKETS = 64 * SUB_BUCKETS; //Buckets for any 64-bit value
+
+  LatencyHistogram() : counts(BUCKETS, 0), total(0), max_value(0) {}
+
+  void add(uint64_t value)
+  {
+    ++counts[bucket(value)];
+    ++total;
+    if (value > max_value)
+      max_value = value;
+  }
+
+  void merge(const LatencyHistogram& other)
+  {
+    for (size_t i = 0; i < BUCKETS; ++i)
+      counts[i] += other.counts[i];
+    total += other.total;
+    if (other.max_value > max_value)
+      max_value = other.max_value;
+  }
+
+  //Lowest value of the bucket that holds the given fraction of values
+  uint64_t percentile(double fraction) const
+  {
+    if (!total)
+      return 0;
+    uint64_t rank = (uint64_t)std::ceil(fraction * total);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; ++i)
+      if ((seen += counts[i]) >= rank && counts[i])
+        return lowest(i);
+    return max_value;
+  }
+
+  uint64_t max() const
+  {
+    return max_value;
+  }
+
+private:
+  std::vector<uint64_t> counts; //Values number by bucket
+  uint64_t total; //Values number
+  uint64_t max_value; //Largest value
+
+  static size_t bucket(uint64_t value)
+  {
+    if (value < SUB_BUCKETS)
+      return (size_t)value;
+    size_t power = 63 - __builtin_clzll(value);
+    return (power - 3) * SUB_BUCKETS + ((value >> (power - 4)) & (SUB_BUCKETS - 1));
+  }
+
+  static uint64_t lowest(size_t index)
+  {
+    if (index < SUB_BUCKETS)
+      return index;
+    size_t power = index / SUB_BUCKETS + 3;
+    return (SUB_BUCKETS + index % SUB_BUCKETS) << (power - 4);
+  }
+};
+
+//Zipfian ranks in [0, n) with skew theta in (0, 1) (Gray et al., "Quickly generating billion-record synthetic databases")
+class ZipfGenerator
+{
+public:
+  ZipfGenerator() : n(1), theta(0), alpha(1), zetan(1), eta(0), half_pow_theta(1) {}
+
+  ZipfGenerator(uint64_t i_n, double i_theta) : n(i_n), theta(i_theta)
+  {
+    zetan = zeta(n, theta);
+    alpha = 1.0 / (1.0 - theta);
+    eta = (1.0 - std::pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta(2, theta) / zetan);
+    half_pow_theta = 1.0 + std::pow(0.5, theta);
+  }
+
+  //Rank for a uniform value u in [0, 1)
+  uint64_t next(double u) const
+  {
+    double uz = u * zetan;
+    if (uz < 1.0)
+      return 0;
+    if (uz < half_pow_theta)
+      return 1;
+    uint64_t rank = (uint64_t)(n * std::pow(eta * u - eta + 1.0, alpha));
+    return rank < n ? rank : n - 1;
+  }
+
+private:
+  uint64_t n; //Ranks number
+  double theta; //Skew
+  double alpha, zetan, eta, half_pow_theta; //Precomputed constants
+
+  static double zeta(uint64_t count, double theta)
+  {
+    double sum = 0;
+    for (uint64_t i = 1; i <= count; ++i)
+      sum += 1.0 / std::pow((double)i, theta);
+    return sum;
+  }
+};
+
+//Wall-clock throughput and latency benchmark of Set<T> implementations (keys are T(0) ... T(key_range - 1))
+//Workers are created and the set is prefilled before the run, then a barrier releases them into a warm-up
+//phase followed by the measured one. Every worker picks operations by the mix and keys by the distribution,
+//times every call and keeps its own histogram and event counters, so the measured loop shares nothing but the set.
+//Event counters cover the whole measured loop of a worker, key generation and timing included.
+template <class T>
+class Benchmark
+{
+public:
+  enum Format { FORMAT_TEXT, FORMAT_CSV, FORMAT_JSON };
+
+  //Benchmark parameters
+  struct Options
+  {
+    Options() : threads(1), duration_ms(200), warmup_ms(50), read_percent(80), insert_percent(10), delete_percent(10),
+      key_range(1024), zipf_theta(0), batch(1), counters(true), per_thread(false), sweep(false), format(FORMAT_TEXT) {}
+
+    size_t threads; //Worker threads (the largest number in a sweep)
+    size_t duration_ms; //Measured phase length
+    size_t warmup_ms; //Warm-up phase length
+    size_t read_percent, insert_percent, delete_percent; //Operation mix (sums to 100)
+    size_t key_range; //Keys are taken from [0, key_range)
+    double zipf_theta; //Zipfian skew, uniform keys if 0
+    size_t batch; //Keys passed to one add_all/remove_all/contains_all call, single operations if 1
+    bool counters; //Whether to count hardware and software events
+    bool per_thread; //Whether to report every worker as well
+    bool sweep; //Whether to run with 1, 2, 4 ... threads up to threads
+    Format format; //Results output format
+    std::string image; //Image file for the warm restart comparison (none if empty)
+  };
+
+  //Measured phase of one worker
+  struct WorkerResult
+  {
+    uint64_t operations; //Operations done
+    PerfCounters::Values counters; //Events counted
+  };
+
+  //Results of one set
+  struct Result
+  {
+    std::string name; //Set name
+    size_t threads; //Worker threads
+    uint64_t operations; //Operations done in the measured phase
+    double seconds; //Measured phase wall time
+    uint64_t p50, p90, p99, p999, max; //Latency of a call in nanoseconds
+    PerfCounters::Values counters; //Events counted by all workers
+    std::vector<WorkerResult> workers; //Results by worker
+    SetStatistics statistics; //Set statistics of the measured phase (with SET_STATS)
+
+    double throughput() const
+    {
+      return seconds > 0 ? operations / seconds : 0;
+    }
+  };
+
+  //Warm restart of one set: every key added by add(...) against the same elements loaded from an image
+  struct RestartResult
+  {
+    std::string name; //Set name
+    size_t elements; //Elements in the set
+    double insert_seconds; //Adding every key to a new set
+    double save_seconds; //Writing the image
+    double load_seconds; //Mapping the image and loading it into a new set
+  };
+
+  Benchmark(const Options& i_options) : options(i_options), phase(PHASE_WARMUP)
+  {
+    if (!error_handler) //Error handler needs to be specified before
+      error_handler(g_msg_err_error_handler);
+    if (options.read_percent + options.insert_percent + options.delete_percent != 100)
+      error_handler(g_msg_err_benchmark_mix);
+    if (!options.threads || !options.key_range || !options.batch)
+      error_handler(g_msg_err_benchmark_options);
+    if (options.zipf_theta < 0 || options.zipf_theta >= 1)
+      error_handler(g_msg_err_benchmark_options);
+    if (options.zipf_theta > 0)
+      zipf = ZipfGenerator(options.key_range, options.zipf_theta);
+    //Hot Zipfian ranks are scattered over the key range so they do not gather at the head of a list
+    keys.reserve(options.key_range);
+    for (size_t i = 0; i < options.key_range; ++i)
+      keys.push_back(T(i));
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    for (size_t i = keys.size() - 1; i > 0; --i)
+      std::swap(keys[i], keys[next_random(state) % (i + 1)]);
+  }
+
+  //Worker thread numbers to run with: options.threads or 1, 2, 4 ... options.threads in a sweep
+  std::vector<size_t> thread_counts() const
+  {
+    std::vector<size_t> counts;
+    if (options.sweep)
+      for (size_t count = 1; count < options.threads; count *= 2)
+        counts.push_back(count);
+    counts.push_back(options.threads);
+    return counts;
+  }
+
+  //Run the benchmark with the given number of workers on a new set made by the factory
+  //Workers are instantiated for the set type S, so a final set class is called without the virtual table
+  //(S = Set<T> measures through it).
+  template <class S>
+  Result run(const char* name, S*(*create)(), size_t threads_num)
+  {
+    S* set = create();
+    if (!set)
+      error_handler(g_msg_err_node_create);
+    //Half of the keys are in the set, balanced inserts and deletes keep it there (added as one batch)
+    std::vector<T> prefill;
+    for (size_t i = 0; i < keys.size(); i += 2)
+      prefill.push_back(keys[i]);
+    set->add_all(prefill.data(), prefill.data() + prefill.size());
+
+    std::vector<Worker> workers(threads_num);
+    std::vector<pthread_t> threads(threads_num);
+    phase.store(PHASE_WARMUP);
+    if (pthread_barrier_init(&start_barrier, NULL, (unsigned)threads_num + 1) != 0)
+      error_handler(g_msg_err_benchmark_threads);
+    for (size_t i = 0; i < threads_num; ++i)
+    {
+      workers[i].benchmark = this;
+      workers[i].set = set;
+      workers[i].seed = 0x2545F4914F6CDD1DULL * (i + 1);
+      if (pthread_create(&threads[i], NULL, worker_routine<S>, &workers[i]) != 0)
+        error_handler(g_msg_err_benchmark_threads);
+    }
+
+    pthread_barrier_wait(&start_barrier);
+    std::this_thread::sleep_for(std::chrono::milliseconds(options.warmup_ms));
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    set->reset_statistics();
+    phase.store(PHASE_MEASURE);
+    std::this_thread::sleep_for(std::chrono::milliseconds(options.duration_ms));
+    phase.store(PHASE_STOP);
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    SetStatistics statistics = set->statistics();
+    for (size_t i = 0; i < threads_num; ++i)
+      pthread_join(threads[i], NULL);
+    pthread_barrier_destroy(&start_barrier);
+    delete set;
+
+    Result result;
+    result.name = name;
+    result.threads = threads_num;
+    result.operations = 0;
+    result.seconds = std::chrono::duration<double>(end - begin).count();
+    result.statistics = statistics;
+    LatencyHistogram latency;
+    for (size_t i = 0; i < threads_num; ++i)
+    {
+      result.operations += workers[i].result.operations;
+      result.counters.add(workers[i].result.counters);
+      result.workers.push_back(workers[i].result);
+      latency.merge(workers[i].latency);
+    }
+    result.p50 = latency.percentile(0.5);
+    result.p90 = latency.percentile(0.9);
+    result.p99 = latency.percentile(0.99);
+    result.p999 = latency.percentile(0.999);
+    result.max = latency.max();
+    return result;
+  }
+
+  //Compare a restart that adds every key again with one that maps an image of the set and builds the set from it
+  //(see SetImage::create, one thread, the image is written to options.image). The factory only makes the first set.
+  template <class S>
+  RestartResult restart(const char* name, S*(*create)())
+  {
+    RestartResult result;
+    result.name = name;
+    S* set = create();
+    if (!set)
+      error_handler(g_msg_err_node_create);
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < keys.size(); ++i)
+      set->add(keys[i]);
+    std::chrono::steady_clock::time_point inserted = std::chrono::steady_clock::now();
+    if (!SetImage<T>::save(*set, options.image.c_str()))
+      error_handler(g_msg_err_benchmark_image);
+    std::chrono::steady_clock::time_point saved = std::chrono::steady_clock::now();
+    delete set;
+
+    std::chrono::steady_clock::time_point opening = std::chrono::steady_clock::now();
+    SetImage<T> image;
+    if (!image.open(options.image.c_str()))
+      error_handler(g_msg_err_benchmark_image);
+    set = image.template create<S>();
+    if (!set)
+      error_handler(g_msg_err_node_create);
+    std::chrono::steady_clock::time_point loaded = std::chrono::steady_clock::now();
+    result.elements = image.size();
+    delete set;
+
+    result.insert_seconds = std::chrono::duration<double>(inserted - begin).count();
+    result.save_seconds = std::chrono::duration<double>(saved - inserted).count();
+    result.load_seconds = std::chrono::duration<double>(loaded - opening).count();
+    return result;
+  }
+
+  //Print warm restart results (text in every format)
+  void print_restart(const std::vector<RestartResult>& results, std::ostream& out) const
+  {
+    out << "Warm restart (" << options.key_range << " keys, image " << options.image << "):\n" << std::left << std::setw(12)
+      << "Set" << std::right << std::setw(10) << "elements" << std::setw(12) << "insert ms" << std::setw(10) << "save ms"
+      << std::setw(10) << "load ms" << std::setw(10) << "speedup" << '\n';
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+      const RestartResult& r = results[i];
+      std::ostringstream row;
+      row << std::fixed << std::setprecision(2) << std::setw(12) << r.insert_seconds * 1000 << std::setw(10)
+        << r.save_seconds * 1000 << std::setw(10) << r.load_seconds * 1000 << std::setw(10)
+        << (r.load_seconds > 0 ? r.insert_seconds / r.load_seconds : 0);
+      out << std::left << std::setw(12) << r.name << std::right << std::setw(10) << r.elements << row.str() << '\n';
+    }
+  }
+
+  //Print results in the configured format
+  void print(const std::vector<Result>& results, std::ostream& out) const
+  {
+    if (options.format == FORMAT_CSV)
+      print_csv(results, out);
+    else if (options.format == FORMAT_JSON)
+      print_json(results, out);
+    else
+    {
+      out << "Threads: " << options.threads << ", mix (read/insert/delete): " << options.read_percent << '/'
+        << options.insert_percent << '/' << options.delete_percent << ", keys: " << options.key_range << " ("
+        << (options.zipf_theta > 0 ? "zipf" : "uniform") << "), batch: " << options.batch << '\n';
+      if (options.sweep)
+        print_scaling(results, out);
+      else
+        print_table(results, out);
+      if (SetStats::ENABLED)
+        print_statistics(results, out);
+    }
+  }
+
+  static void set_error_handler(void(*handler)(const char*))
+  {
+    error_handler = handler;
+  }
+
+private:
+  enum Phase { PHASE_WARMUP, PHASE_MEASURE, PHASE_STOP };
+
+  //State of a worker thread
+  struct Worker
+  {
+    Worker() : benchmark(nullptr), set(nullptr), seed(0)
+    {
+      result.operations = 0;
+    }
+
+    Benchmark* benchmark; //Running benchmark
+    Set<T>* set; //Tested set
+    uint64_t seed; //Random generator state
+    WorkerResult result; //Operations and events in the measured phase
+    LatencyHistogram latency; //Call latency in the measured phase
+    char padding[64]; //Keep hot fields of different workers in different cache lines
+  };
+
+  Options options; //Benchmark parameters
+  std::vector<T> keys; //Keys by rank
+  ZipfGenerator zipf; //Ranks generator for Zipfian keys
+  std::atomic<int> phase; //Current phase
+  pthread_barrier_t start_barrier; //Releases workers when all of them are ready
+  static void(*error_handler)(const char*); //Fatal errors handler
+
+  //xorshift64*
+  static uint64_t next_random(uint64_t& state)
+  {
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 0x2545F4914F6CDD1DULL;
+  }
+
+  const T& next_key(uint64_t& state) const
+  {
+    uint64_t random = next_random(state);
+    if (options.zipf_theta > 0)
+      return keys[zipf.next((random >> 11) * (1.0 / 9007199254740992.0))];
+    return keys[random % options.key_range];
+  }
+
+  template <class S>
+  static void* worker_routine(void* parameter)
+  {
+    Worker& worker = *reinterpret_cast<Worker*>(parameter);
+    worker.benchmark->template work<S>(worker);
+    pthread_exit(0);
+  }
+
+  template <class S>
+  void work(Worker& worker)
+  {
+    S& set = static_cast<S&>(*worker.set);
+    std::vector<T> batch_keys(options.batch, keys[0]);
+    bool* found = new bool[options.batch];
+    PerfCounters* counters = options.counters ? new PerfCounters() : nullptr; //Counts events of this thread
+    bool measuring = false;
+    pthread_barrier_wait(&start_barrier);
+    for (int current = phase.load(std::memory_order_relaxed); current != PHASE_STOP; current = phase.load(std::memory_order_relaxed))
+    {
+      if (current == PHASE_MEASURE && !measuring)
+      {
+        measuring = true;
+        if (counters)
+          counters->start();
+      }
+      size_t operation = next_random(worker.seed) % 100;
+      for (size_t i = 0; i < options.batch; ++i)
+        batch_keys[i] = next_key(worker.seed);
+
+      std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+      if (options.batch == 1)
+      {
+        if (operation < options.read_percent)
+          set.contains(batch_keys[0]);
+        else if (operation < options.read_percent + options.insert_percent)
+          set.add(batch_keys[0]);
+        else
+          set.remove(batch_keys[0]);
+      }
+      else
+      {
+        const T* keys_begin = &batch_keys[0];
+        if (operation < options.read_percent)
+          set.contains_all(keys_begin, keys_begin + options.batch, found);
+        else if (operation < options.read_percent + options.insert_percent)
+          set.add_all(keys_begin, keys_begin + options.batch);
+        else
+          set.remove_all(keys_begin, keys_begin + options.batch);
+      }
+      std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+      if (measuring)
+      {
+        worker.result.operations += options.batch;
+        worker.latency.add(std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count());
+      }
+    }
+    if (counters && measuring)
+      counters->stop(worker.result.counters);
+    else
+      for (size_t i = 0; i < PerfCounters::EVENTS; ++i)
+        worker.result.counters.available[i] = false;
+    delete counters;
+    delete[] found;
+  }
+
+  //Event count per operation
+  static double per_operation(const PerfCounters::Values& counters, size_t event, uint64_t operations)
+  {
+    return operations ? (double)counters.value[event] / operations : 0;
+  }
+
+  void print_csv(const std::vector<Result>& results, std::ostream& out) const
+  {
+    //Every set has a row for all workers (worker "all") and rows for separate workers if asked
+    out << "set,threads,worker,read,insert,delete,keys,zipf,batch,operations,seconds,ops_per_sec,p50_ns,p90_ns,p99_ns,p999_ns,max_ns";
+    for (size_t event = 0; event < PerfCounters::EVENTS; ++event)
+      out << ',' << PerfCounters::name((PerfCounters::Event)event);
+    if (SetStats::ENABLED)
+      out << ",retries,lock_acquisitions,lock_wait_ns,traversals,traversal_steps,allocations,retirements";
+    out << '\n';
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+      const Result& r = results[i];
+      for (size_t worker = 0; worker <= (options.per_thread ? r.workers.size() : 0); ++worker)
+      {
+        const PerfCounters::Values& counters = worker ? r.workers[worker - 1].counters : r.counters;
+        out << r.name << ',' << r.threads << ',';
+        if (worker)
+          out << worker - 1;
+        else
+          out << "all";
+        out << ',' << options.read_percent << ',' << options.insert_percent << ',' << options.delete_percent << ','
+          << options.key_range << ',' << options.zipf_theta << ',' << options.batch << ','
+          << (worker ? r.workers[worker - 1].operations : r.operations) << ',' << r.seconds << ',';
+        if (!worker)
+          out << (uint64_t)r.throughput() << ',' << r.p50 << ',' << r.p90 << ',' << r.p99 << ',' << r.p999 << ',' << r.max;
+        else
+          out << ",,,,,";
+        for (size_t event = 0; event < PerfCounters::EVENTS; ++event)
+        {
+          out << ',';
+          if (counters.available[event])
+            out << counters.value[event];
+        }
+        if (SetStats::ENABLED && !worker)
+        {
+          const SetStatistics& st = r.statistics;
+          out << ',' << st.retries << ',' << st.lock_acquisitions << ',' << st.lock_wait_ns << ',' << st.traversals << ','
+            << st.traversal_steps << ',' << st.allocations << ',' << st.retirements;
+        }
+        else if (SetStats::ENABLED)
+          out << ",,,,,,,";
+        out << '\n';
+      }
+    }
+  }
+
+  static void print_json_counters(const PerfCounters::Values& counters, uint64_t operations, std::ostream& out)
+  {
+    out << "\"counters\": {";
+    for (size_t event = 0; event < PerfCounters::EVENTS; ++event)
+    {
+      out << (event ? ", \"" : "\"") << PerfCounters::name((PerfCounters::Event)event) << "\": ";
+      if (counters.available[event])
+        out << "{\"total\": " << counters.value[event] << ", \"per_op\": " << per_operation(counters, event, operations) << '}';
+      else
+        out << "null";
+    }
+    out << '}';
+  }
+
+  void print_json(const std::vector<Result>& results, std::ostream& out) const
+  {
+    out << "{\"read\": " << options.read_percent << ", \"insert\": " << options.insert_percent << ", \"delete\": "
+      << options.delete_percent << ", \"keys\": " << options.key_range << ", \"zipf\": " << options.zipf_theta
+      << ", \"batch\": " << options.batch << ", \"warmup_ms\": " << options.warmup_ms << ", \"duration_ms\": "
+      << options.duration_ms << ",\n \"results\": [";
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+      const Result& r = results[i];
+      out << (i ? ",\n  " : "\n  ") << "{\"set\": \"" << r.name << "\", \"threads\": " << r.threads << ", \"operations\": "
+        << r.operations << ", \"seconds\": " << r.seconds << ", \"ops_per_sec\": " << (uint64_t)r.throughput()
+        << ", \"latency_ns\": {\"p50\": " << r.p50 << ", \"p90\": " << r.p90 << ", \"p99\": " << r.p99
+        << ", \"p999\": " << r.p999 << ", \"max\": " << r.max << "}, ";
+      print_json_counters(r.counters, r.operations, out);
+      if (SetStats::ENABLED)
+      {
+        const SetStatistics& st = r.statistics;
+        out << ", \"statistics\": {\"retries\": " << st.retries << ", \"lock_acquisitions\": " << st.lock_acquisitions
+          << ", \"lock_wait_ns\": " << st.lock_wait_ns << ", \"traversals\": " << st.traversals << ", \"traversal_steps\": "
+          << st.traversal_steps << ", \"allocations\": " << st.allocations << ", \"retirements\": " << st.retirements << '}';
+      }
+      if (options.per_thread)
+      {
+        out << ", \"workers\": [";
+        for (size_t worker = 0; worker < r.workers.size(); ++worker)
+        {
+          out << (worker ? ", " : "") << "{\"operations\": " << r.workers[worker].operations << ", ";
+          print_json_counters(r.workers[worker].counters, r.workers[worker].operations, out);
+          out << '}';
+        }
+        out << ']';
+      }
+      out << '}';
+    }
+    out << "\n]}\n";
+  }
+
+  //Events per operation columns of the text table
+  static void print_text_counters(const PerfCounters::Values& counters, uint64_t operations, std::ostream& out)
+  {
+    static const int widths[PerfCounters::EVENTS] = { 10, 10, 9, 9, 8 };
+    for (size_t event = 0; event < PerfCounters::EVENTS; ++event)
+    {
+      std::ostringstream cell;
+      if (!counters.available[event])
+        cell << "n/a";
+      else if (event == PerfCounters::CONTEXT_SWITCHES)
+        cell << counters.value[event];
+      else
+        cell << std::fixed << std::setprecision(1) << per_operation(counters, event, operations);
+      out << std::setw(widths[event]) << cell.str();
+    }
+    out << '\n';
+  }
+
+  void print_table(const std::vector<Result>& results, std::ostream& out) const
+  {
+    out << std::left << std::setw(12) << "Set" << std::right << std::setw(14) << "ops/sec" << std::setw(10) << "p50 ns"
+      << std::setw(10) << "p90 ns" << std::setw(10) << "p99 ns" << std::setw(11) << "p99.9 ns" << std::setw(12) << "max ns";
+    if (options.counters)
+      out << std::setw(10) << "cyc/op" << std::setw(10) << "ins/op" << std::setw(9) << "LLC/op" << std::setw(9) << "br/op"
+        << std::setw(8) << "cs";
+    out << '\n';
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+      const Result& r = results[i];
+      out << std::left << std::setw(12) << r.name << std::right << std::setw(14) << (uint64_t)r.throughput()
+        << std::setw(10) << r.p50 << std::setw(10) << r.p90 << std::setw(10) << r.p99 << std::setw(11) << r.p999
+        << std::setw(12) << r.max;
+      if (!options.counters)
+      {
+        out << '\n';
+        continue;
+      }
+      print_text_counters(r.counters, r.operations, out);
+      if (options.per_thread)
+        for (size_t worker = 0; worker < r.workers.size(); ++worker)
+        {
+          std::string title = "  #" + std::to_string(worker);
+          out << std::left << std::setw(12) << title << std::right << std::setw(14) << r.workers[worker].operations
+            << std::setw(53) << "";
+          print_text_counters(r.workers[worker].counters, r.workers[worker].operations, out);
+        }
+    }
+  }
+
+  //Set statistics per operation (built with SET_STATS)
+  void print_statistics(const std::vector<Result>& results, std::ostream& out) const
+  {
+    out << "Set statistics per operation:\n" << std::left << std::setw(12) << "Set" << std::right << std::setw(8) << "threads"
+      << std::setw(10) << "retries" << std::setw(10) << "locks" << std::setw(12) << "wait ns" << std::setw(10) << "nodes"
+      << std::setw(10) << "allocs" << std::setw(10) << "retired" << '\n';
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+      const Result& r = results[i];
+      const SetStatistics& st = r.statistics;
+      double operations = r.operations ? (double)r.operations : 1;
+      std::ostringstream row;
+      row << std::fixed << std::setprecision(2) << std::setw(10) << st.retries / operations << std::setw(10)
+        << st.lock_acquisitions / operations << std::setw(12) << st.lock_wait_ns / operations << std::setw(10)
+        << st.traversal_steps / operations << std::setw(10) << st.allocations / operations << std::setw(10)
+        << st.retirements / operations;
+      out << std::left << std::setw(12) << r.name << std::right << std::setw(8) << r.threads << row.str() << '\n';
+    }
+  }
+
+  //Throughput of every set by thread number with the speedup over one thread
+  void print_scaling(const std::vector<Result>& results, std::ostream& out) const
+  {
+    std::vector<size_t> counts = thread_counts();
+    out << std::left << std::setw(12) << "Set" << std::right;
+    for (size_t i = 0; i < counts.size(); ++i)
+      out << std::setw(20) << std::to_string(counts[i]) + (counts[i] == 1 ? " thread" : " threads");
+    out << '\n';
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+      if (results[i].threads != counts[0])
+        continue;
+      out << std::left << std::setw(12) << results[i].name << std::right;
+      for (size_t j = i; j < results.size(); ++j)
+        if (results[j].name == results[i].name)
+        {
+          std::ostringstream cell;
+          cell << (uint64_t)results[j].throughput() << " (x" << std::fixed << std::setprecision(2)
+            << (results[i].throughput() > 0 ? results[j].throughput() / results[i].throughput() : 0) << ')';
+          out << std::setw(20) << cell.str();
+        }
+      out << '\n';
+    }
+  }
+};
+
+template <class T>
+void(*Benchmark<T>::error_handler)(const char*) = nullptr;
+
+#endif
@@ -0,0 +1,210 @@
+
+#ifndef CONCURRENT_MAP_TWKXRD__
+#define CONCURRENT_MAP_TWKXRD__
+
+#include <functional>
+#include <utility>
+#include <type_traits>
+#include <bits/stdc++.h>
+
+#include "set.h"
+#include "locks.hpp"
+#include "node_alloc.hpp"
+#include "list_fgs.hpp"
+
+//Concurrent map on the engine of the fine-grained synchronization set (Lock is a lock policy from locks.hpp,
+//Alloc is a node allocation policy from node_alloc.hpp)
+//Keys are spread over Buckets lock-coupled lists (see list_fgs.hpp) by the Fibonacci hash of their hash, every
+//list is ordered by (hash, key). The key and the value are stored in the node, and a value is read or
+//updated under the lock of its node, so insert_or_assign, compute_if_present and fetch_add are atomic with
+//the membership of the key. Nodes are deleted right after unlinking: a thread reaches a node only with its
+//predecessor locked, so nobody can wait for the lock of an unlinked node.
+template <class K, class V, class Lock = LockMutex, class Alloc = AllocDefault, size_t Buckets = 64, class Compare = std::less<K> >
+class ConcurrentMap
+{
+public:
+  static_assert(Buckets >= 2 && (Buckets & (Buckets - 1)) == 0, "Buckets must be a power of 2");
+  static const size_t CACHE_LINE = 64; //Padding between bucket headers
+
+  typedef K key_type;
+  typedef V mapped_type;
+
+  ConcurrentMap()
+  {
+    if (!error_handler) //Error handler needs to be specified before
+      error_handler(g_msg_err_error_handler);
+  }
+
+  //Add the key with the value if it is not in the map (true if was added)
+  bool insert(const K& key, const V& value)
+  {
+    size_t hash = generate_hash(key);
+    Position position;
+    if (locate(hash, key, position))
+    {
+      position.unlock();
+      return false;
+    }
+    link(position, hash, key, value);
+    return true;
+  }
+
+  //Add the key with the value or assign the value to the present key (true if was added)
+  bool insert_or_assign(const K& key, const V& value)
+  {
+    size_t hash = generate_hash(key);
+    Position position;
+    if (locate(hash, key, position))
+    {
+      position.previous->unlock();
+      position.current->payload().value = value;
+      position.current->unlock();
+      return false;
+    }
+    link(position, hash, key, value);
+    return true;
+  }
+
+  //Copy the value of the key (false if it is not in the map)
+  bool find(const K& key, V& value)
+  {
+    size_t hash = generate_hash(key);
+    Position position;
+    if (!locate(hash, key, position))
+    {
+      position.unlock();
+      return false;
+    }
+    position.previous->unlock();
+    value = position.current->payload().value;
+    position.current->unlock();
+    return true;
+  }
+
+  bool contains(const K& key)
+  {
+    size_t hash = generate_hash(key);
+    Position position;
+    bool found = locate(hash, key, position);
+    position.unlock();
+    return found;
+  }
+
+  //Remove the key (true if was removed)
+  bool erase(const K& key)
+  {
+    size_t hash = generate_hash(key);
+    Position position;
+    if (!locate(hash, key, position))
+    {
+      position.unlock();
+      return false;
+    }
+    List::unlink(position);
+    position.unlock();
+    delete position.current;
+    stats.add(SetStats::RETIREMENTS);
+    return true;
+  }
+
+  //Call function(value) for the value of the key under its node lock (false if the key is not in the map)
+  template <class Function>
+  bool compute_if_present(const K& key, Function function)
+  {
+    size_t hash = generate_hash(key);
+    Position position;
+    if (!locate(hash, key, position))
+    {
+      position.unlock();
+      return false;
+    }
+    position.previous->unlock();
+    function(position.current->payload().value);
+    position.current->unlock();
+    return true;
+  }
+
+  //Add delta to the value of the key, a missing key is added with V() + delta (the previous value)
+  V fetch_add(const K& key, const V& delta)
+  {
+    size_t hash = generate_hash(key);
+    Position position;
+    if (!locate(hash, key, position))
+    {
+      link(position, hash, key, V() + delta);
+      return V();
+    }
+    position.previous->unlock();
+    V previous = position.current->payload().value;
+    position.current->payload().value = previous + delta;
+    position.current->unlock();
+    return previous;
+  }
+
+  //Contention statistics since creation or the last reset (zeros unless built with SET_STATS, see set_stats.hpp)
+  SetStatistics statistics() const
+  {
+    return stats.get();
+  }
+
+  void reset_statistics()
+  {
+    stats.reset();
+  }
+
+  static void set_error_handler(void(*handler)(const char*))
+  {
+    error_handler = handler;
+    List::set_error_handler(handler);
+  }
+
+private:
+  typedef ListFGS<EntryPayload<K, V, Compare>, Lock, Alloc> List;
+  typedef typename List::Node Node;
+  typedef typename List::Position Position;
+
+  //Bucket header
+  struct Bucket
+  {
+    List list; //Bucket list
+    char padding[CACHE_LINE]; //Keep headers of different buckets in different cache lines
+  };
+
+  Bucket buckets[Buckets]; //Bucket lists
+  SetStats stats; //Contention statistics (see set_stats.hpp)
+  static void(*error_handler)(const char*); //Fatal errors handler
+
+  //Fibonacci hashing of the key hash (keys that differ only in low bits go to different buckets)
+  static size_t bucket_index(size_t hash)
+  {
+    static const unsigned SHIFT = 64 - __builtin_ctzll(Buckets);
+    return (size_t)(((uint64_t)hash * 0x9E3779B97F4A7C15ULL) >> SHIFT);
+  }
+
+  //Find the key position in its bucket, both nodes of the position stay locked (true if the key is there)
+  bool locate(size_t hash, const K& key, Position& position)
+  {
+    return buckets[bucket_index(hash)].list.locate(hash, key, position, stats);
+  }
+
+  //Link a new entry at the locked position and unlock it
+  void link(Position& position, size_t hash, const K& key, const V& value)
+  {
+    Node* to_insert = new Node(hash, key, value);
+    if (!to_insert)
+      error_handler(g_msg_err_node_create);
+    stats.add(SetStats::ALLOCATIONS);
+    List::link(position, to_insert);
+    position.unlock();
+  }
+
+  size_t generate_hash(const K& key)
+  {
+    return std::hash<K>()(key);
+  }
+};
+
+template <class K, class V, class Lock, class Alloc, size_t Buckets, class Compare>
+void(*ConcurrentMap<K, V, Lock, Alloc, Buckets, Compare>::error_handler)(const char*) = nullptr;
+
+#endif
@@ -0,0 +1,292 @@
+
+#ifndef EPOCH_WQZOXL__
+#define EPOCH_WQZOXL__
+
+#include <atomic>
+#include <vector>
+#include <pthread.h>
+#include <sched.h>
+
+//Epoch-based memory reclamation domain
+//Threads register in the domain once and then enter it (pin the current epoch) for every operation.
+//Objects removed from a shared structure are retired to a per-thread limbo list of the current epoch
+//and freed in batches when the global epoch has moved two steps forward.
+class EpochDomain
+{
+public:
+  static const size_t RETIRE_BATCH = 64; //Retired objects number to try advancing the epoch
+  static const size_t CACHE_LINE = 64; //Padding between thread records
+
+private:
+  static const size_t LIMBO_LISTS = 3; //Limbo lists number (epochs e - 2, e - 1 and e)
+
+  //Object waiting to be freed
+  struct Retired
+  {
+    void* object; //Object to free
+    void(*deleter)(void*); //Function that frees the object
+  };
+
+  //Registered thread state
+  struct ThreadRecord
+  {
+    ThreadRecord() : state(0), owned(true), nesting(0), retired_count(0), next(nullptr)
+    {
+      for (size_t i = 0; i < LIMBO_LISTS; ++i)
+        limbo_epoch[i] = 0;
+    }
+
+    std::atomic<size_t> state; //Pinned epoch shifted left by one with an active flag in the lowest bit
+    std::atomic<bool> owned; //Whether a thread uses the record
+    size_t nesting; //Critical sections nesting level
+    size_t retired_count; //Objects retired since the last attempt to advance the epoch
+    std::vector<Retired> limbo[LIMBO_LISTS]; //Retired objects by epoch
+    size_t limbo_epoch[LIMBO_LISTS]; //Epoch every limbo list was filled in
+    ThreadRecord* next; //Next record of the domain
+    char padding[CACHE_LINE]; //Keep records of different threads in different cache lines
+  };
+
+public:
+  //Critical section: objects reachable at its start are not freed until it ends
+  class Guard
+  {
+  public:
+    Guard(EpochDomain& i_domain) : domain(i_domain), record(i_domain.enter()) {}
+
+    ~Guard()
+    {
+      domain.leave(record);
+    }
+
+    //Pass an unlinked object to the domain to be freed later by the deleter
+    void retire(void* object, void(*deleter)(void*))
+    {
+      domain.retire(record, object, deleter);
+    }
+
+  private:
+    Guard(const Guard&);
+    Guard& operator=(const Guard&);
+
+    EpochDomain& domain; //Entered domain
+    ThreadRecord* record; //Record of the current thread
+  };
+
+  EpochDomain() : global_epoch(0), records(nullptr)
+  {
+    static std::atomic<size_t> ids(0);
+    id = ++ids;
+    registry_lock();
+    registry().push_back(this);
+    registry_unlock();
+  }
+
+  ~EpochDomain()
+  {
+    registry_lock();
+    std::vector<EpochDomain*>& domains = registry();
+    for (size_t i = 0; i < domains.size(); ++i)
+      if (domains[i] == this)
+      {
+        domains.erase(domains.begin() + i);
+        break;
+      }
+    registry_unlock();
+
+    //No thread is inside the domain any more so every retired object can be freed
+    for (ThreadRecord *record = records.load(), *next = nullptr; record != nullptr; record = next)
+    {
+      next = record->next;
+      for (size_t i = 0; i < LIMBO_LISTS; ++i)
+        free_list(record->limbo[i]);
+      delete record;
+    }
+  }
+
+  //Wait until every critical section running at the call has ended, i.e. for a grace period
+  //(the caller must not be inside a critical section of the domain)
+  void synchronize()
+  {
+    for (size_t target = grace_period(); !synchronized(target); sched_yield());
+  }
+
+  //Start a grace period without waiting for it (the epoch that ends it, see synchronized(...))
+  size_t grace_period()
+  {
+    return global_epoch.load() + 2;
+  }
+
+  //Try to end a grace period started by grace_period() (true if it has passed)
+  bool synchronized(size_t target)
+  {
+    if (global_epoch.load(std::memory_order_acquire) < target)
+      try_advance();
+    return global_epoch.load(std::memory_order_acquire) >= target;
+  }
+
+private:
+  //Registration of the current thread in a domain
+  struct Registration
+  {
+    size_t domain_id; //Unique id of the domain (addresses can be reused)
+    EpochDomain* domain; //Domain
+    ThreadRecord* record; //Record owned by the thread
+  };
+
+  //Registrations of a thread, released when the thread exits
+  struct ThreadRegistrations
+  {
+    ~ThreadRegistrations()
+    {
+      registry_lock();
+      std::vector<EpochDomain*>& domains = registry();
+      for (size_t i = 0; i < entries.size(); ++i)
+        for (size_t j = 0; j < domains.size(); ++j)
+          if (domains[j] == entries[i].domain && domains[j]->id == entries[i].domain_id)
+            entries[i].record->owned.store(false, std::memory_order_release);
+      registry_unlock();
+    }
+
+    std::vector<Registration> entries; //Registrations
+  };
+
+  size_t id; //Unique id of the domain
+  std::atomic<size_t> global_epoch; //Global epoch
+  std::atomic<ThreadRecord*> records; //Records of the registered threads
+
+  //Live domains (threads release their records only in domains that still exist)
+  static std::vector<EpochDomain*>& registry()
+  {
+    static std::vector<EpochDomain*> domains;
+    return domains;
+  }
+
+  static pthread_mutex_t* registry_mutex()
+  {
+    static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    return &mutex;
+  }
+
+  static void registry_lock()
+  {
+    pthread_mutex_lock(registry_mutex());
+  }
+
+  static void registry_unlock()
+  {
+    pthread_mutex_unlock(registry_mutex());
+  }
+
+  //Get the record of the current thread (register the thread if it is the first time)
+  ThreadRecord* get_record()
+  {
+    static thread_local ThreadRegistrations registrations;
+    for (size_t i = 0; i < registrations.entries.size(); ++i)
+      if (registrations.entries[i].domain == this && registrations.entries[i].domain_id == id)
+        return registrations.entries[i].record;
+
+    //Reuse a record of an exited thread or push a new one
+    ThreadRecord* record = nullptr;
+    for (ThreadRecord* current = records.load(std::memory_order_acquire); current != nullptr && !record; current = current->next)
+    {
+      bool expected = false;
+      if (!current->owned.load(std::memory_order_relaxed) && current->owned.compare_exchange_strong(expected, true, std::memory_order_acquire))
+        record = current;
+    }
+    if (!record)
+    {
+      record = new ThreadRecord();
+      ThreadRecord* head = records.load(std::memory_order_relaxed);
+      do
+        record->next = head;
+      while (!records.compare_exchange_weak(head, record, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    //Forget registrations in destroyed domains
+    for (size_t i = 0; i < registrations.entries.size(); )
+      if (registrations.entries[i].domain == this)
+        registrations.entries.erase(registrations.entries.begin() + i);
+      else
+        ++i;
+    Registration registration = { id, this, record };
+    registrations.entries.push_back(registration);
+    return record;
+  }
+
+  //Pin the current epoch
+  ThreadRecord* enter()
+  {
+    ThreadRecord* record = get_record();
+    if (record->nesting++ == 0)
+    {
+      size_t epoch = global_epoch.load(std::memory_order_relaxed);
+      record->state.store((epoch << 1) | 1, std::memory_order_relaxed);
+      //The pinned epoch has to be visible before any shared pointer is read
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      free_expired(record, global_epoch.load(std::memory_order_relaxed));
+    }
+    return record;
+  }
+
+  //Unpin the epoch
+  void leave(ThreadRecord* record)
+  {
+    if (--record->nesting == 0)
+      record->state.store(0, std::memory_order_release);
+  }
+
+  void retire(ThreadRecord* record, void* object, void(*deleter)(void*))
+  {
+    //The object is tagged with the global epoch at the moment it is already unlinked (threads that could
+    //reach it have pinned that epoch or an earlier one)
+    size_t epoch = global_epoch.load();
+    size_t index = epoch % LIMBO_LISTS;
+    //The list may still hold objects of an epoch at least three steps back, they are safe to free
+    if (record->limbo_epoch[index] != epoch)
+    {
+      free_list(record->limbo[index]);
+      record->limbo_epoch[index] = epoch;
+    }
+    Retired retired = { object, deleter };
+    record->limbo[index].push_back(retired);
+
+    if (++record->retired_count >= RETIRE_BATCH)
+    {
+      record->retired_count = 0;
+      try_advance();
+      free_expired(record, global_epoch.load(std::memory_order_relaxed));
+    }
+  }
+
+  //Move the global epoch forward if every active thread has pinned it
+  void try_advance()
+  {
+    size_t epoch = global_epoch.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    for (ThreadRecord* record = records.load(std::memory_order_acquire); record != nullptr; record = record->next)
+    {
+      size_t state = record->state.load(std::memory_order_relaxed);
+      if ((state & 1) && (state >> 1) != epoch)
+        return;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    global_epoch.compare_exchange_strong(epoch, epoch + 1);
+  }
+
+  //Free limbo lists that were filled two or more epochs before the global one
+  void free_expired(ThreadRecord* record, size_t epoch)
+  {
+    for (size_t i = 0; i < LIMBO_LISTS; ++i)
+      if (!record->limbo[i].empty() && record->limbo_epoch[i] + 2 <= epoch)
+        free_list(record->limbo[i]);
+  }
+
+  static void free_list(std::vector<Retired>& list)
+  {
+    for (size_t i = 0; i < list.size(); ++i)
+      list[i].deleter(list[i].object);
+    list.clear();
+  }
+};
+
+#endif
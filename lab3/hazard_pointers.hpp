@@ -0,0 +1,144 @@
+
+#ifndef HAZARD_POINTERS_ZKQPRW__
+#define HAZARD_POINTERS_ZKQPRW__
+
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <sched.h>
+
+//Hazard pointers domain: K hazard pointers per thread protect Node objects from being freed
+template <class Node, size_t K>
+class HazardDomain
+{
+public:
+  static const size_t MAX_RECORDS = 128; //Maximum number of threads inside the domain at the same time
+  static const size_t CACHE_LINE = 64; //Padding between records
+  static const size_t MIN_RETIRE_THRESHOLD = 64; //Minimum number of retired nodes before a scan
+
+private:
+  //Per-thread hazard pointers and retired nodes
+  struct Record
+  {
+    Record() : active(false)
+    {
+      for (size_t i = 0; i < K; ++i)
+        hazards[i].store(nullptr, std::memory_order_relaxed);
+    }
+
+    std::atomic<Node*> hazards[K]; //Nodes the owner thread is going to access
+    std::atomic<bool> active; //Whether the record is owned by a thread
+    std::vector<Node*> retired; //Removed nodes that are not freed yet
+    char padding[CACHE_LINE]; //Keep records of different threads in different cache lines
+  };
+
+public:
+  //Ownership of a record for the duration of a set operation
+  class Guard
+  {
+  public:
+    Guard(HazardDomain& i_domain) : domain(i_domain), record(i_domain.acquire()) {}
+
+    ~Guard()
+    {
+      for (size_t i = 0; i < K; ++i)
+        record->hazards[i].store(nullptr, std::memory_order_release);
+      record->active.store(false, std::memory_order_release);
+    }
+
+    //Announce that the thread is going to access a node (the caller has to re-validate the source afterwards)
+    void protect(size_t index, Node* node)
+    {
+      record->hazards[index].store(node);
+    }
+
+    //Pass an unlinked node to the domain to be freed when no hazard pointer refers to it
+    void retire(Node* node)
+    {
+      record->retired.push_back(node);
+      if (record->retired.size() >= domain.retire_threshold())
+        domain.scan(record);
+    }
+
+  private:
+    Guard(const Guard&);
+    Guard& operator=(const Guard&);
+
+    HazardDomain& domain; //Domain of the record
+    Record* record; //Owned record
+  };
+
+  HazardDomain() : records_used(0) {}
+
+  ~HazardDomain()
+  {
+    //No thread is inside the domain any more so every retired node can be freed
+    for (size_t i = 0; i < MAX_RECORDS; ++i)
+      for (size_t j = 0; j < records[i].retired.size(); ++j)
+        delete records[i].retired[j];
+  }
+
+private:
+  Record records[MAX_RECORDS]; //Records of the threads
+  std::atomic<size_t> records_used; //Records high-water mark
+
+  //Take an inactive record (start from a per-thread hint to avoid fighting over the same records)
+  Record* acquire()
+  {
+    static thread_local size_t hint = std::hash<std::thread::id>()(std::this_thread::get_id()) % MAX_RECORDS;
+    while (true)
+    {
+      for (size_t i = 0; i < MAX_RECORDS; ++i)
+      {
+        size_t index = (hint + i) % MAX_RECORDS;
+        bool expected = false;
+        if (!records[index].active.load(std::memory_order_relaxed) &&
+          records[index].active.compare_exchange_strong(expected, true, std::memory_order_acquire))
+        {
+          hint = index;
+          //The high-water mark has to be published before any hazard pointer of the record
+          size_t used = records_used.load();
+          while (used < index + 1 && !records_used.compare_exchange_weak(used, index + 1));
+          return &records[index];
+        }
+      }
+      sched_yield(); //Every record is busy
+    }
+  }
+
+  //Retired nodes number to trigger a scan (has to exceed the number of hazard pointers in use)
+  size_t retire_threshold() const
+  {
+    size_t threshold = 2 * K * records_used.load(std::memory_order_relaxed);
+    return threshold > MIN_RETIRE_THRESHOLD ? threshold : MIN_RETIRE_THRESHOLD;
+  }
+
+  //Free retired nodes of the record that are not protected by any hazard pointer
+  void scan(Record* record)
+  {
+    std::vector<Node*> protected_nodes;
+    size_t used = records_used.load();
+    for (size_t i = 0; i < used; ++i)
+      for (size_t j = 0; j < K; ++j)
+      {
+        Node* node = records[i].hazards[j].load();
+        if (node)
+          protected_nodes.push_back(node);
+      }
+    std::sort(protected_nodes.begin(), protected_nodes.end());
+
+    std::vector<Node*> still_retired;
+    for (size_t i = 0; i < record->retired.size(); ++i)
+    {
+      if (std::binary_search(protected_nodes.begin(), protected_nodes.end(), record->retired[i]))
+        still_retired.push_back(record->retired[i]);
+      else
+        delete record->retired[i];
+    }
+    record->retired.swap(still_retired);
+  }
+};
+
+#endif
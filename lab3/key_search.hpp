@@ -0,0 +1,64 @@
+
+#ifndef KEY_SEARCH_HBXQZN__
+#define KEY_SEARCH_HBXQZN__
+
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+//Search of a key in a sorted block of keys padded with SIZE_MAX up to a multiple of 4
+//AVX2 and SSE4.2 versions compare 4 or 2 keys per instruction and are picked at run time,
+//so the default build flags still get them on CPUs that have them.
+class KeySearch
+{
+public:
+  //Number of keys less than key among the first count keys
+  static size_t lower_bound(const size_t* keys, size_t count, size_t key)
+  {
+#if defined(__x86_64__)
+    static const int level = __builtin_cpu_supports("avx2") ? 2 : __builtin_cpu_supports("sse4.2") ? 1 : 0;
+    if (level == 2)
+      return lower_bound_avx2(keys, count, key);
+    if (level == 1)
+      return lower_bound_sse42(keys, count, key);
+#endif
+    return std::lower_bound(keys, keys + count, key) - keys;
+  }
+
+private:
+#if defined(__x86_64__)
+  //Keys are unsigned and the compare instructions are signed, so both sides have the sign bit flipped
+  __attribute__((target("avx2")))
+  static size_t lower_bound_avx2(const size_t* keys, size_t count, size_t key)
+  {
+    const __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+    const __m256i needle = _mm256_xor_si256(_mm256_set1_epi64x((long long)key), sign);
+    size_t less = 0;
+    for (size_t i = 0; i < count; i += 4)
+    {
+      __m256i block = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i)), sign);
+      less += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(needle, block))));
+    }
+    return less;
+  }
+
+  __attribute__((target("sse4.2")))
+  static size_t lower_bound_sse42(const size_t* keys, size_t count, size_t key)
+  {
+    const __m128i sign = _mm_set1_epi64x(INT64_MIN);
+    const __m128i needle = _mm_xor_si128(_mm_set1_epi64x((long long)key), sign);
+    size_t less = 0;
+    for (size_t i = 0; i < count; i += 2)
+    {
+      __m128i block = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i)), sign);
+      less += __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(needle, block))));
+    }
+    return less;
+  }
+#endif
+};
+
+#endif
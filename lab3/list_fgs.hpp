@@ -0,0 +1,262 @@
+
+#ifndef LIST_FGS_JQWNBE__
+#define LIST_FGS_JQWNBE__
+
+#include <functional>
+#include <utility>
+#include <type_traits>
+#include <bits/stdc++.h>
+
+#include "set.h"
+#include "locks.hpp"
+#include "node_alloc.hpp"
+
+//Payload of set nodes: the element, ordered by Compare
+template <class T, class Compare = std::less<T> >
+struct ItemPayload
+{
+  typedef T Stored; //Data of a node
+  typedef T Probe; //What the list is searched by
+
+  static const Probe& probe(const Stored& stored)
+  {
+    return stored;
+  }
+
+  static bool less(const Probe& left, const Probe& right)
+  {
+    return Compare()(left, right);
+  }
+};
+
+//Payload of map nodes: the key with its value, ordered by the key
+template <class K, class V, class Compare = std::less<K> >
+struct EntryPayload
+{
+  struct Stored
+  {
+    Stored(const K& init_key, const V& init_value) : key(init_key), value(init_value) {}
+
+    K key; //Key
+    V value; //Value next to the key
+  };
+
+  typedef K Probe;
+
+  static const Probe& probe(const Stored& stored)
+  {
+    return stored.key;
+  }
+
+  static bool less(const Probe& left, const Probe& right)
+  {
+    return Compare()(left, right);
+  }
+};
+
+//Sorted list with lock coupling, the engine of SetFGS and ConcurrentMap (Payload is the data of a node and
+//its order, e.g. ItemPayload or EntryPayload; Lock is a lock policy from locks.hpp, Alloc is a node allocation
+//policy from node_alloc.hpp)
+//The list is ordered by (key, payload): keys are hashes, payloads with colliding keys are kept apart by the
+//payload order, which has to agree with the hash. The sentinels are told apart by their rank, so any key can
+//be stored. A thread moves along the list holding the locks of two neighbour nodes, so it reaches a node only
+//with its predecessor locked.
+template <class Payload, class Lock = LockMutex, class Alloc = AllocDefault>
+class ListFGS
+{
+public:
+  typedef typename Payload::Stored Stored;
+  typedef typename Payload::Probe Probe;
+
+  //Node of the list
+  class Node
+  {
+  public:
+    enum Rank { RANK_HEAD, RANK_ITEM, RANK_TAIL };
+
+    //Sentinel: the head comes before and the tail after every payload, whatever its key
+    explicit Node(Rank init_rank) : key(init_rank == RANK_HEAD ? 0 : SIZE_MAX), rank(init_rank), next(nullptr) {}
+
+    //Payload node built from the arguments (the key is computed once by the caller)
+    template <class... Args>
+    Node(size_t init_key, Args&&... args) : key(init_key), rank(RANK_ITEM), next(nullptr)
+    {
+      new (&storage) Stored(std::forward<Args>(args)...);
+    }
+
+    ~Node()
+    {
+      if (rank == RANK_ITEM)
+        payload().~Stored();
+    }
+
+    size_t key; //Data key (hash)
+    Rank rank; //Sentinel or payload
+    Node* next; //Pointer to the next node
+
+    //Raw data (payload nodes only)
+    Stored& payload()
+    {
+      return *reinterpret_cast<Stored*>(&storage);
+    }
+
+    const Stored& payload() const
+    {
+      return *reinterpret_cast<const Stored*>(&storage);
+    }
+
+    //Whether the node comes before the probe (payloads are compared only if the keys collide)
+    bool before(size_t other_key, const Probe& other) const
+    {
+      if (key != other_key)
+        return key < other_key;
+      if (rank != RANK_ITEM)
+        return rank == RANK_HEAD;
+      return Payload::less(Payload::probe(payload()), other);
+    }
+
+    //Whether the node holds the probe
+    bool holds(size_t other_key, const Probe& other) const
+    {
+      return key == other_key && rank == RANK_ITEM && equivalent(Payload::probe(payload()), other);
+    }
+
+    static bool equivalent(const Probe& left, const Probe& right)
+    {
+      return !Payload::less(left, right) && !Payload::less(right, left);
+    }
+
+    //Allocate nodes with the allocation policy (nullptr on failure)
+    static void* operator new(size_t) noexcept
+    {
+      return Alloc::template allocate<sizeof(Node)>();
+    }
+
+    static void operator delete(void* block)
+    {
+      Alloc::template deallocate<sizeof(Node)>(block);
+    }
+
+    //Lock the node
+    void lock(SetStats& stats)
+    {
+      SetStats::LockTiming timing(stats);
+      if (!node_lock.lock())
+        error_handler(g_msg_err_mutex_lock);
+    }
+
+    //Unlock the node
+    void unlock()
+    {
+      if (!node_lock.unlock())
+        error_handler(g_msg_err_mutex_unlock);
+    }
+
+  private:
+    typename std::aligned_storage<sizeof(Stored), alignof(Stored)>::type storage; //Payload (constructed in payload nodes only)
+    Lock node_lock; //Node lock (see locks.hpp for policies)
+  };
+
+  //Locked neighbour nodes around a key position
+  struct Position
+  {
+    Node* previous; //Last node before the key
+    Node* current; //First node not before the key
+
+    void unlock()
+    {
+      current->unlock();
+      previous->unlock();
+    }
+  };
+
+  ListFGS()
+  {
+    if (!error_handler) //Error handler needs to be specified before
+      error_handler(g_msg_err_error_handler);
+    //Initialize head of the list and it's next element
+    head_node = new Node(Node::RANK_HEAD);
+    if (!head_node)
+      error_handler(g_msg_err_node_create);
+    head_node->next = new Node(Node::RANK_TAIL);
+    if (!head_node->next)
+      error_handler(g_msg_err_node_create);
+  }
+
+  ~ListFGS()
+  {
+    //Delete all nodes of the list
+    for (Node *current = head_node, *next = nullptr; current != nullptr; current = next)
+    {
+      next = current->next;
+      delete current;
+    }
+  }
+
+  Node* head() const
+  {
+    return head_node;
+  }
+
+  //Lock the head and its successor: the position before every payload
+  void start(Position& position, SetStats& stats)
+  {
+    head_node->lock(stats);
+    position.previous = head_node;
+    position.current = head_node->next;
+    position.current->lock(stats);
+  }
+
+  //Move the locked position forward until it is at the probe (number of nodes passed)
+  static size_t advance(Position& position, size_t key, const Probe& probe, SetStats& stats)
+  {
+    size_t steps = 0;
+    while (position.current->before(key, probe))
+    {
+      ++steps;
+      position.previous->unlock();
+      position.previous = position.current;
+      position.current = position.current->next;
+      position.current->lock(stats);
+    }
+    return steps;
+  }
+
+  //Find the probe position from the head, both nodes of the position stay locked (true if it holds the probe)
+  bool locate(size_t key, const Probe& probe, Position& position, SetStats& stats)
+  {
+    start(position, stats);
+    stats.traversal(advance(position, key, probe, stats));
+    return position.current->holds(key, probe);
+  }
+
+  //Link a node between the locked nodes of the position
+  static void link(Position& position, Node* node)
+  {
+    node->next = position.current;
+    position.previous->next = node;
+  }
+
+  //Unlink the current node of the locked position (it stays locked and is not freed)
+  static void unlink(Position& position)
+  {
+    position.previous->next = position.current->next;
+  }
+
+  static void set_error_handler(void(*handler)(const char*))
+  {
+    error_handler = handler;
+  }
+
+private:
+  ListFGS(const ListFGS&);
+  ListFGS& operator=(const ListFGS&);
+
+  Node* head_node; //Head of the list
+  static void(*error_handler)(const char*); //Fatal errors handler
+};
+
+template <class Payload, class Lock, class Alloc>
+void(*ListFGS<Payload, Lock, Alloc>::error_handler)(const char*) = nullptr;
+
+#endif
@@ -0,0 +1,202 @@
+
+#ifndef LOCKS_PQMZTR__
+#define LOCKS_PQMZTR__
+
+#include <atomic>
+#include <cstdint>
+#include <pthread.h>
+#include <sched.h>
+
+//Lock policies for node-locked sets
+//Every policy is default-constructible and has lock()/unlock() returning false on failure.
+
+static inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
+//Exponential spin-wait: pause 1, 2, 4, ... times, then yield the CPU (the holder may be preempted)
+class SpinWait
+{
+public:
+  static const unsigned YIELD_LIMIT = 1024; //Pause iterations before giving the CPU away
+
+  SpinWait() : iterations(1) {}
+
+  void wait()
+  {
+    if (iterations > YIELD_LIMIT)
+    {
+      sched_yield();
+      return;
+    }
+    for (unsigned i = 0; i < iterations; ++i)
+      cpu_relax();
+    iterations <<= 1;
+  }
+
+private:
+  unsigned iterations; //Pause iterations of the next wait
+};
+
+//pthread mutex (sleeps in the kernel on contention)
+class LockMutex
+{
+public:
+  LockMutex() : mutex(PTHREAD_MUTEX_INITIALIZER) {}
+
+  bool lock()
+  {
+    return pthread_mutex_lock(&mutex) == 0;
+  }
+
+  bool unlock()
+  {
+    return pthread_mutex_unlock(&mutex) == 0;
+  }
+
+private:
+  pthread_mutex_t mutex; //Mutex
+};
+
+//Test-and-test-and-set spinlock with exponential backoff
+class LockTTAS
+{
+public:
+  LockTTAS() : locked(false) {}
+
+  bool lock()
+  {
+    SpinWait backoff;
+    while (true)
+    {
+      //Spin on a local cached copy until the lock looks free
+      SpinWait spin;
+      while (locked.load(std::memory_order_relaxed))
+        spin.wait();
+      if (!locked.exchange(true, std::memory_order_acquire))
+        return true;
+      backoff.wait();
+    }
+  }
+
+  //Take the lock only if it is free (true if taken)
+  bool try_lock()
+  {
+    return !locked.load(std::memory_order_relaxed) && !locked.exchange(true, std::memory_order_acquire);
+  }
+
+  bool unlock()
+  {
+    locked.store(false, std::memory_order_release);
+    return true;
+  }
+
+private:
+  std::atomic<bool> locked; //Lock state
+};
+
+//Ticket spinlock (FIFO order)
+class LockTicket
+{
+public:
+  LockTicket() : next_ticket(0), now_serving(0) {}
+
+  bool lock()
+  {
+    uint32_t ticket = next_ticket.fetch_add(1, std::memory_order_relaxed);
+    SpinWait spin;
+    while (now_serving.load(std::memory_order_acquire) != ticket)
+      spin.wait();
+    return true;
+  }
+
+  bool unlock()
+  {
+    now_serving.store(now_serving.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    return true;
+  }
+
+private:
+  std::atomic<uint32_t> next_ticket; //Next ticket to take
+  std::atomic<uint32_t> now_serving; //Ticket of the holder
+};
+
+//MCS queue lock (every waiter spins on its own queue node)
+class LockMCS
+{
+public:
+  LockMCS() : tail(nullptr), holder(nullptr) {}
+
+  bool lock()
+  {
+    QueueNode* node = acquire_queue_node();
+    if (!node)
+      return false;
+    node->next.store(nullptr, std::memory_order_relaxed);
+    node->locked.store(true, std::memory_order_relaxed);
+    QueueNode* predecessor = tail.exchange(node, std::memory_order_acq_rel);
+    if (predecessor)
+    {
+      predecessor->next.store(node, std::memory_order_release);
+      SpinWait spin;
+      while (node->locked.load(std::memory_order_acquire))
+        spin.wait();
+    }
+    holder = node;
+    return true;
+  }
+
+  bool unlock()
+  {
+    QueueNode* node = holder;
+    QueueNode* successor = node->next.load(std::memory_order_acquire);
+    if (!successor)
+    {
+      QueueNode* expected = node;
+      if (tail.compare_exchange_strong(expected, nullptr, std::memory_order_acq_rel))
+      {
+        node->in_use = false;
+        return true;
+      }
+      //A successor has swapped the tail but has not linked itself yet
+      SpinWait spin;
+      while (!(successor = node->next.load(std::memory_order_acquire)))
+        spin.wait();
+    }
+    successor->locked.store(false, std::memory_order_release);
+    node->in_use = false;
+    return true;
+  }
+
+private:
+  //Queue node of a waiting or holding thread
+  struct QueueNode
+  {
+    std::atomic<QueueNode*> next; //Next waiter
+    std::atomic<bool> locked; //Whether the owner has to wait
+    bool in_use; //Whether the node is taken by one of the thread's locks
+  };
+
+  static const size_t MAX_HELD = 8; //Maximum number of MCS locks a thread holds at the same time
+
+  std::atomic<QueueNode*> tail; //Last waiter
+  QueueNode* holder; //Queue node of the holder (written and read under the lock only)
+
+  //Take a free queue node of the current thread (lock coupling holds up to two locks)
+  static QueueNode* acquire_queue_node()
+  {
+    static thread_local QueueNode nodes[MAX_HELD];
+    for (size_t i = 0; i < MAX_HELD; ++i)
+      if (!nodes[i].in_use)
+      {
+        nodes[i].in_use = true;
+        return &nodes[i];
+      }
+    return nullptr;
+  }
+};
+
+#endif
@@ -2,35 +2,159 @@
 #include <cstdlib>
 #include <string>
 #include <ctime>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <climits>
+#include <chrono>
+#include <thread>
 
 #include "set.h"
 #include "set_fgs.hpp"
 #include "set_os.hpp"
+#include "set_lazy.hpp"
+#include "set_lf.hpp"
+#include "set_hash.hpp"
+#include "set_skiplist.hpp"
+#include "set_fc.hpp"
+#include "set_unrolled.hpp"
+#include "set_btree.hpp"
+#include "set_sharded.hpp"
+#include "set_rcu.hpp"
+#include "set_adaptive.hpp"
+#include "concurrent_map.hpp"
+#include "priority_queue.hpp"
+#include "locks.hpp"
+#include "node_alloc.hpp"
+#include "benchmark.hpp"
+#include "map_benchmark.hpp"
+#include "queue_benchmark.hpp"
+
+//Tested set description
+//Tests and the speed test are instantiated for the set type, so they call the set without the virtual table
+struct TestedSet
+{
+  const char* name; //Short name for speed test output
+  const char* title; //Full name for correctness test output
+  Set<int>*(*create)(); //Set factory
+  void(*test)(Set<int>*); //Correctness tests
+  Benchmark<int>::Result(*measure)(Benchmark<int>&, const char*, size_t); //Speed test with the given number of threads
+  Benchmark<int>::RestartResult(*restart)(Benchmark<int>&, const char*); //Warm restart from an image
+  Set<int>* p_set; //Set instance
+};
+
+//Error handler
+void on_error(const char* msg);
+
+//Create a set of the provided type
+template <class S>
+static S* create_set()
+{
+  S::set_error_handler(on_error);
+  return new S();
+}
+
+template <class S>
+static Set<int>* create_tested_set()
+{
+  return create_set<S>();
+}
+
+template <class S>
+static void test_set(Set<int>* p_set);
+
+template <class S>
+static Benchmark<int>::Result measure_set(Benchmark<int>& benchmark, const char* name, size_t threads_num)
+{
+  return benchmark.run(name, create_set<S>, threads_num);
+}
+
+template <class S>
+static Benchmark<int>::RestartResult restart_set(Benchmark<int>& benchmark, const char* name)
+{
+  return benchmark.restart(name, create_set<S>);
+}
+
+//Description of a set of the provided type
+template <class S>
+static TestedSet tested_set(const char* name, const char* title)
+{
+  TestedSet tested = { name, title, create_tested_set<S>, test_set<S>, measure_set<S>, restart_set<S>, NULL };
+  return tested;
+}
+
+//Tested sets
+TestedSet tested_sets[] =
+{
+  tested_set<SetFGS<int> >("FGS", "Fine-grained sync set"),
+  tested_set<SetFGS<int, LockTTAS> >("FGS-TTAS", "Fine-grained sync set (TTAS spinlock)"),
+  tested_set<SetFGS<int, LockTicket> >("FGS-Ticket", "Fine-grained sync set (ticket lock)"),
+  tested_set<SetFGS<int, LockMCS> >("FGS-MCS", "Fine-grained sync set (MCS lock)"),
+  tested_set<SetFGS<int, LockMutex, AllocPool> >("FGS-Pool", "Fine-grained sync set (node pool)"),
+  tested_set<SetOS<int> >("OS", "Optimistic sync set"),
+  tested_set<SetOS<int, LockTTAS> >("OS-TTAS", "Optimistic sync set (TTAS spinlock)"),
+  tested_set<SetOS<int, LockTicket> >("OS-Ticket", "Optimistic sync set (ticket lock)"),
+  tested_set<SetOS<int, LockMCS> >("OS-MCS", "Optimistic sync set (MCS lock)"),
+  tested_set<SetOS<int, LockMutex, AllocPool> >("OS-Pool", "Optimistic sync set (node pool)"),
+  tested_set<SetLazy<int> >("Lazy", "Lazy sync set"),
+  tested_set<SetLockFree<int> >("LF", "Lock-free set"),
+  tested_set<SetHash<int> >("Hash", "Split-ordered hash set"),
+  tested_set<SetSkipList<int> >("SkipList", "Lock-free skip list set"),
+  tested_set<SetFlatCombining<int> >("FC", "Flat-combining set"),
+  tested_set<SetUnrolled<int> >("Unrolled", "Unrolled list set"),
+  tested_set<SetBTree<int> >("BTree", "B+-tree set (optimistic lock coupling)"),
+  tested_set<SetSharded<SetFGS<int> > >("Sharded-FGS", "Sharded fine-grained sync set"),
+  tested_set<SetSharded<SetOS<int> > >("Sharded-OS", "Sharded optimistic sync set"),
+  tested_set<SetRCU<int> >("RCU", "Read-copy-update set"),
+  tested_set<SetAdaptive<int> >("Adaptive", "Contention-adaptive set")
+};
+const size_t tested_sets_n = sizeof(tested_sets) / sizeof(tested_sets[0]);
 
 //Global scope pointers
-Set<int>* p_set1 = NULL;
-Set<int>* p_set2 = NULL;
 Set<int>* working_set = NULL;
 
 //Test options
 size_t writers = 10;
 size_t readers = 10;
 size_t entries = 10;
+bool use_batches = false; //Whether routines pass their data to the set as one batch
 
-//Data for speed tests
+//Data for tests
 int* shared_data = NULL;
 int* complex_test_data = NULL;
-size_t tests_n = 10;
 size_t complex_readers_block_size = 0;
 
+//Speed test options (threads default to readers + writers)
+Benchmark<int>::Options benchmark_options;
+std::string benchmarked_sets; //Comma-separated names of sets to measure (all if empty)
+bool run_tests = true; //Whether correctness tests run before the speed test
+bool run_maps = false; //Whether maps are measured after the sets
+bool run_queues = false; //Whether priority queues are measured after the sets
+
+//Tested map
+typedef ConcurrentMap<int, long> TestedMap;
+TestedMap* working_map = NULL;
+std::atomic<size_t> map_failures(0); //Failed operations in map test routines
+
+//Tested priority queue
+typedef MultiQueue<int> TestedQueue;
+TestedQueue* working_queue = NULL;
+std::atomic<size_t>* popped_counts = NULL; //Times every element was popped in the queue test
+
+//Read-copy-update set of the versions test
+typedef SetRCU<int> TestedRCU;
+TestedRCU* working_rcu = NULL;
+std::atomic<bool> rcu_writers_done(false);
+std::atomic<size_t> rcu_overflows(0); //Times more replaced versions than the limit were waiting
+
 //Error handler
 void on_error(const char* msg)
 {
   std::cerr << msg << std::endl;
-  if (p_set1)
-    delete p_set1;
-  if (p_set2)
-    delete p_set2;
+  for (size_t i = 0; i < tested_sets_n; ++i)
+    if (tested_sets[i].p_set)
+      delete tested_sets[i].p_set;
   exit(1);
 }
 
@@ -49,20 +173,30 @@ public:
 };
 
 //Readers test thread routine 
+template <class S>
 static void* readers_routine(void* parameter)
 {
   int* data = reinterpret_cast<int*>(parameter);
-  for (size_t i = 0; i < entries; ++i)
-    working_set->remove(data[i]);
+  S* set = static_cast<S*>(working_set);
+  if (use_batches)
+    set->remove_all(data, data + entries);
+  else
+    for (size_t i = 0; i < entries; ++i)
+      set->remove(data[i]);
   pthread_exit(0);
 }
 
-//Writers test thread routine
+//Writers test thread routine (single elements are built in place)
+template <class S>
 static void* writers_routine(void* parameter)
 {
   int* data = reinterpret_cast<int*>(parameter);
-  for (size_t i = 0; i < entries; ++i)
-    working_set->add(data[i]);
+  S* set = static_cast<S*>(working_set);
+  if (use_batches)
+    set->add_all(data, data + entries);
+  else
+    for (size_t i = 0; i < entries; ++i)
+      set->emplace(data[i]);
   pthread_exit(0);
 }
 
@@ -78,6 +212,7 @@ static void create_and_run_threads(pthread_t* threads, pthread_attr_t* attribute
     pthread_join(threads[i], NULL);
 }
 
+template <class S>
 static TestResult test_readers()
 {
   pthread_t* threads = new pthread_t[readers];
@@ -86,10 +221,9 @@ static TestResult test_readers()
   if (!threads || !attributes)
     on_error("Memory allocation problem");
 
-  for (size_t i = 0; i < readers * entries; ++i)
-    working_set->add(shared_data[i]);
+  working_set->add_all(shared_data, shared_data + readers * entries);
 
-  create_and_run_threads(threads, attributes, readers, entries, readers_routine);
+  create_and_run_threads(threads, attributes, readers, entries, readers_routine<S>);
 
   for (size_t i = 0; i < readers * entries; ++i)
     if (working_set->contains(shared_data[i]))
@@ -100,6 +234,7 @@ static TestResult test_readers()
   return TestResult(true);
 }
 
+template <class S>
 static TestResult test_writers()
 {
   pthread_t* threads = new pthread_t[writers];
@@ -107,7 +242,7 @@ static TestResult test_writers()
   if (!threads || !attributes)
     on_error("Memory allocation problem");
 
-  create_and_run_threads(threads, attributes, writers, entries, writers_routine);
+  create_and_run_threads(threads, attributes, writers, entries, writers_routine<S>);
 
   for (size_t i = 0; i < writers * entries; ++i)
   {
@@ -122,26 +257,40 @@ static TestResult test_writers()
 }
 
 //Readers complex test thread routine 
+template <class S>
 static void* readers_complex_routine(void* parameter)
 {
   int* data = reinterpret_cast<int*>(parameter);
-  for (size_t i = 0; i < complex_readers_block_size; ++i)
-    if (working_set->contains(data[i]))
-      ++complex_test_data[data[i]];
+  S* set = static_cast<S*>(working_set);
+  if (use_batches)
+  {
+    bool* found = new bool[complex_readers_block_size];
+    set->contains_all(data, data + complex_readers_block_size, found);
+    for (size_t i = 0; i < complex_readers_block_size; ++i)
+      if (found[i])
+        ++complex_test_data[data[i]];
+    delete[] found;
+  }
+  else
+    for (size_t i = 0; i < complex_readers_block_size; ++i)
+      if (set->contains(data[i]))
+        ++complex_test_data[data[i]];
   pthread_exit(0);
 }
 
+template <class S>
 static void create_and_run_threads_complex_readers(pthread_t* threads, pthread_attr_t* attributes)
 {
   for (size_t i = 0; i < readers; ++i)
     pthread_attr_init(&(attributes[i]));
   for (size_t i = 0; i < readers; ++i)
-    if (pthread_create(&(threads[i]), &(attributes[i]), readers_complex_routine, shared_data + i * complex_readers_block_size) != 0)
+    if (pthread_create(&(threads[i]), &(attributes[i]), readers_complex_routine<S>, shared_data + i * complex_readers_block_size) != 0)
       on_error("Too many threads");
   for (size_t i = 0; i < readers; ++i)
     pthread_join(threads[i], NULL);
 }
 
+template <class S>
 static TestResult test_complex()
 {
   pthread_t* threads = new pthread_t[writers];
@@ -153,7 +302,7 @@ static TestResult test_complex()
 
   for (size_t i = 0; i < writers * entries; ++i)
     complex_test_data[i] = 0;
-  create_and_run_threads(threads, attributes, writers, entries, writers_routine);
+  create_and_run_threads(threads, attributes, writers, entries, writers_routine<S>);
 
   delete[] threads;
   delete[] attributes;
@@ -162,12 +311,13 @@ static TestResult test_complex()
   if (!threads || !attributes)
     on_error("Memory allocation problem");
 
-  create_and_run_threads_complex_readers(threads, attributes);
+  create_and_run_threads_complex_readers<S>(threads, attributes);
 
+  //Readers cover the first test_size positions of the data, whatever values are there
   size_t test_size = writers * entries - (writers * entries) % complex_readers_block_size;
-  for (size_t i = 0; i < test_size; ++i)
-    if (complex_test_data[i] != 1)
-      return TestResult(false);
+  bool success = true;
+  for (size_t i = 0; i < test_size && success; ++i)
+    success = complex_test_data[shared_data[i]] == 1;
 
   for (size_t i = 0; i < writers * entries; ++i)
     working_set->remove(shared_data[i]);
@@ -175,7 +325,168 @@ static TestResult test_complex()
   delete[] complex_test_data;
   delete[] threads;
   delete[] attributes;
-  return TestResult(true);
+  return TestResult(success);
+}
+
+//Snapshot test state
+std::atomic<bool> snapshot_writers_done(false);
+std::atomic<bool> snapshot_inconsistent(false);
+
+//Check that a snapshot is sorted and holds a prefix of every writer's data (writers add their data in order)
+static bool check_snapshot(const std::vector<int>& items)
+{
+  std::vector<bool> present(writers * entries, false);
+  for (size_t i = 0; i < items.size(); ++i)
+  {
+    if (i > 0 && items[i - 1] >= items[i])
+      return false;
+    present[items[i]] = true;
+  }
+  for (size_t i = 0; i < writers; ++i)
+    for (size_t j = 1; j < entries; ++j)
+      if (present[shared_data[i * entries + j]] && !present[shared_data[i * entries + j - 1]])
+        return false;
+  return true;
+}
+
+//Snapshot test thread routine
+static void* snapshot_routine(void*)
+{
+  std::vector<int> items;
+  do
+  {
+    working_set->snapshot(items);
+    if (!check_snapshot(items))
+      snapshot_inconsistent = true;
+  } while (!snapshot_writers_done);
+  pthread_exit(0);
+}
+
+//Range query callback (counts elements)
+static void count_item(const int&, void* context)
+{
+  ++*reinterpret_cast<size_t*>(context);
+}
+
+template <class S>
+static TestResult test_snapshot()
+{
+  pthread_t* threads = new pthread_t[writers];
+  pthread_attr_t* attributes = new pthread_attr_t[writers];
+  pthread_t snapshot_thread;
+  if (!threads || !attributes)
+    on_error("Memory allocation problem");
+
+  snapshot_writers_done = false;
+  snapshot_inconsistent = false;
+  if (pthread_create(&snapshot_thread, NULL, snapshot_routine, NULL) != 0)
+    on_error("Too many threads");
+  create_and_run_threads(threads, attributes, writers, entries, writers_routine<S>);
+  snapshot_writers_done = true;
+  pthread_join(snapshot_thread, NULL);
+
+  //Every element is added now: the snapshot is full and ranges hold every key between bounds
+  std::vector<int> items;
+  working_set->snapshot(items);
+  size_t half = writers * entries / 2, counted = 0;
+  size_t reported = working_set->range(0, (int)half - 1, count_item, &counted);
+  bool success = !snapshot_inconsistent && items.size() == writers * entries && check_snapshot(items) &&
+    reported == half && counted == half;
+
+  for (size_t i = 0; i < writers * entries; ++i)
+    working_set->remove(shared_data[i]);
+
+  delete[] threads;
+  delete[] attributes;
+  return TestResult(success);
+}
+
+//Snapshot progress test state
+static const size_t PROGRESS_KEYS = 20000; //Elements that stay in the set while the writers run
+static const size_t PROGRESS_SNAPSHOTS = 8; //Snapshots taken while the writers run
+static const int PROGRESS_TIMEOUT_MS = 10000; //Time the snapshots have to be taken in
+std::atomic<bool> progress_writers_stop(false);
+std::atomic<bool> progress_snapshots_done(false);
+std::atomic<bool> progress_inconsistent(false);
+
+//Snapshot progress test writers routine: every thread adds and removes its own elements until it is stopped
+template <class S>
+static void* progress_writers_routine(void* parameter)
+{
+  int* data = reinterpret_cast<int*>(parameter);
+  S* set = static_cast<S*>(working_set);
+  while (!progress_writers_stop)
+    for (size_t i = 0; i < entries; ++i)
+    {
+      set->add(data[i]);
+      set->remove(data[i]);
+    }
+  pthread_exit(0);
+}
+
+//Snapshot progress test snapshot routine: every snapshot is sorted and holds all elements that stay in the set
+static void* progress_snapshot_routine(void*)
+{
+  std::vector<int> items;
+  for (size_t i = 0; i < PROGRESS_SNAPSHOTS; ++i)
+  {
+    working_set->snapshot(items);
+    size_t stayed = 0;
+    for (size_t j = 0; j < items.size(); ++j)
+    {
+      if (j > 0 && items[j - 1] >= items[j])
+        progress_inconsistent = true;
+      if (items[j] >= (int)(writers * entries))
+        ++stayed;
+    }
+    if (stayed != PROGRESS_KEYS)
+      progress_inconsistent = true;
+  }
+  progress_snapshots_done = true;
+  pthread_exit(0);
+}
+
+//Snapshots must complete while the writers keep modifying the set
+template <class S>
+static TestResult test_snapshot_progress()
+{
+  pthread_t* threads = new pthread_t[writers];
+  pthread_attr_t* attributes = new pthread_attr_t[writers];
+  int* stayed = new int[PROGRESS_KEYS];
+  pthread_t snapshot_thread;
+  if (!threads || !attributes || !stayed)
+    on_error("Memory allocation problem");
+  for (size_t i = 0; i < PROGRESS_KEYS; ++i)
+    stayed[i] = (int)(writers * entries + i);
+  working_set->add_all(stayed, stayed + PROGRESS_KEYS);
+
+  progress_writers_stop = false;
+  progress_snapshots_done = false;
+  progress_inconsistent = false;
+  for (size_t i = 0; i < writers; ++i)
+  {
+    pthread_attr_init(&attributes[i]);
+    if (pthread_create(&threads[i], &attributes[i], progress_writers_routine<S>, shared_data + i * entries) != 0)
+      on_error("Too many threads");
+  }
+  if (pthread_create(&snapshot_thread, NULL, progress_snapshot_routine, NULL) != 0)
+    on_error("Too many threads");
+  //The writers are stopped only when the snapshots are done or the time is out
+  std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(PROGRESS_TIMEOUT_MS);
+  while (!progress_snapshots_done && std::chrono::steady_clock::now() < deadline)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  bool completed = progress_snapshots_done;
+  progress_writers_stop = true;
+  for (size_t i = 0; i < writers; ++i)
+    pthread_join(threads[i], NULL);
+  pthread_join(snapshot_thread, NULL);
+  bool success = completed && !progress_inconsistent;
+
+  working_set->remove_all(stayed, stayed + PROGRESS_KEYS);
+  delete[] stayed;
+  delete[] threads;
+  delete[] attributes;
+  return TestResult(success);
 }
 
 //Prepare shared data for a test
@@ -222,103 +533,423 @@ static void prepare_shared_data_fixed(size_t threads_num, size_t threads_data_en
       shared_data[i * threads_data_entries + j] = (int)(i + j * threads_num);
 }
 
+//Add one to a map value (for compute_if_present)
+struct IncrementValue
+{
+  void operator()(long& value) const
+  {
+    ++value;
+  }
+};
+
+//Map writers test thread routine: every thread adds one to every value with fetch_add and with compute_if_present
+static void* map_writers_routine(void*)
+{
+  for (size_t i = 0; i < writers * entries; ++i)
+  {
+    working_map->fetch_add(shared_data[i], 1);
+    if (!working_map->compute_if_present(shared_data[i], IncrementValue()))
+      ++map_failures;
+  }
+  pthread_exit(0);
+}
+
+//Map erasers test thread routine: every thread erases its own keys
+static void* map_erasers_routine(void* parameter)
+{
+  int* data = reinterpret_cast<int*>(parameter);
+  for (size_t i = 0; i < entries; ++i)
+    if (!working_map->erase(data[i]))
+      ++map_failures;
+  pthread_exit(0);
+}
+
+//Concurrent updates of the same keys must not lose any increment
+static TestResult test_map()
+{
+  pthread_t* threads = new pthread_t[writers];
+  pthread_attr_t* attributes = new pthread_attr_t[writers];
+  TestedMap::set_error_handler(on_error);
+  working_map = new TestedMap();
+  if (!threads || !attributes || !working_map)
+    on_error("Memory allocation problem");
+  map_failures.store(0);
+
+  create_and_run_threads(threads, attributes, writers, entries, map_writers_routine);
+  bool success = map_failures.load() == 0;
+  for (size_t i = 0; i < writers * entries && success; ++i)
+  {
+    long value = 0;
+    success = working_map->find(shared_data[i], value) && value == (long)(2 * writers) &&
+      !working_map->insert_or_assign(shared_data[i], value);
+  }
+
+  create_and_run_threads(threads, attributes, writers, entries, map_erasers_routine);
+  success = success && map_failures.load() == 0;
+  for (size_t i = 0; i < writers * entries && success; ++i)
+    success = !working_map->contains(shared_data[i]);
+
+  delete working_map;
+  working_map = NULL;
+  delete[] threads;
+  delete[] attributes;
+  return TestResult(success);
+}
+
+//Queue producers test thread routine: every thread pushes its own elements
+static void* queue_producers_routine(void* parameter)
+{
+  int* data = reinterpret_cast<int*>(parameter);
+  for (size_t i = 0; i < entries; ++i)
+    working_queue->push(data[i]);
+  pthread_exit(0);
+}
+
+//Queue consumers test thread routine: every thread pops until the queue is empty
+static void* queue_consumers_routine(void*)
+{
+  int item = 0;
+  while (working_queue->pop_min(item))
+    popped_counts[item].fetch_add(1, std::memory_order_relaxed);
+  pthread_exit(0);
+}
+
+//Concurrent consumers must pop every pushed element exactly once
+static TestResult test_queue()
+{
+  size_t threads_num = std::max(readers, writers);
+  pthread_t* threads = new pthread_t[threads_num];
+  pthread_attr_t* attributes = new pthread_attr_t[threads_num];
+  TestedQueue::set_error_handler(on_error);
+  working_queue = new TestedQueue();
+  popped_counts = new std::atomic<size_t>[writers * entries];
+  if (!threads || !attributes || !working_queue || !popped_counts)
+    on_error("Memory allocation problem");
+  for (size_t i = 0; i < writers * entries; ++i)
+    popped_counts[i].store(0);
+
+  create_and_run_threads(threads, attributes, writers, entries, queue_producers_routine);
+  bool success = working_queue->size() == writers * entries;
+  create_and_run_threads(threads, attributes, readers, 0, queue_consumers_routine);
+  for (size_t i = 0; i < writers * entries && success; ++i)
+    success = popped_counts[i].load() == 1;
+  success = success && working_queue->empty();
+
+  delete working_queue;
+  working_queue = NULL;
+  delete[] popped_counts;
+  popped_counts = NULL;
+  delete[] threads;
+  delete[] attributes;
+  return TestResult(success);
+}
+
+//Versions test readers routine: every thread searches the set until the writers are done
+static void* rcu_readers_routine(void*)
+{
+  do
+    for (size_t i = 0; i < writers * entries; ++i)
+      working_rcu->contains(shared_data[i]);
+  while (!rcu_writers_done);
+  pthread_exit(0);
+}
+
+//Versions test writers routine: every thread adds and removes its own elements several times
+static void* rcu_writers_routine(void* parameter)
+{
+  int* data = reinterpret_cast<int*>(parameter);
+  for (size_t round = 0; round < 8; ++round)
+    for (size_t i = 0; i < entries; ++i)
+    {
+      working_rcu->add(data[i]);
+      working_rcu->remove(data[i]);
+      if (working_rcu->retired_versions() > TestedRCU::MAX_RETIRED_VERSIONS)
+        ++rcu_overflows;
+    }
+  pthread_exit(0);
+}
+
+//Replaced versions of the read-copy-update set must be freed while readers keep searching it
+static TestResult test_rcu_versions()
+{
+  pthread_t* threads = new pthread_t[readers];
+  pthread_attr_t* attributes = new pthread_attr_t[readers];
+  pthread_t* writer_threads = new pthread_t[writers];
+  pthread_attr_t* writer_attributes = new pthread_attr_t[writers];
+  TestedRCU::set_error_handler(on_error);
+  working_rcu = new TestedRCU();
+  if (!threads || !attributes || !writer_threads || !writer_attributes || !working_rcu)
+    on_error("Memory allocation problem");
+  rcu_writers_done = false;
+  rcu_overflows.store(0);
+
+  for (size_t i = 0; i < readers; ++i)
+  {
+    pthread_attr_init(&attributes[i]);
+    if (pthread_create(&threads[i], &attributes[i], rcu_readers_routine, NULL) != 0)
+      on_error("Too many threads");
+  }
+  create_and_run_threads(writer_threads, writer_attributes, writers, entries, rcu_writers_routine);
+  rcu_writers_done = true;
+  for (size_t i = 0; i < readers; ++i)
+    pthread_join(threads[i], NULL);
+  bool success = rcu_overflows.load() == 0 && working_rcu->retired_versions() <= TestedRCU::MAX_RETIRED_VERSIONS;
+
+  delete working_rcu;
+  working_rcu = NULL;
+  delete[] threads;
+  delete[] attributes;
+  delete[] writer_threads;
+  delete[] writer_attributes;
+  return TestResult(success);
+}
+
+//Keys at the ends of the hash range (0, INT_MAX and -1, whose hash is SIZE_MAX) must not be taken for the sentinels
+template <class S>
+static TestResult test_edge_keys()
+{
+  static const int edge_keys[] = { 0, INT_MAX, -1, INT_MIN };
+  static const size_t edge_keys_n = sizeof(edge_keys) / sizeof(edge_keys[0]);
+  S* set = static_cast<S*>(working_set);
+  bool success = true;
+  for (size_t i = 0; i < edge_keys_n; ++i)
+    success = success && !set->contains(edge_keys[i]) && !set->remove(edge_keys[i]);
+  for (size_t i = 0; i < edge_keys_n; ++i)
+    success = success && set->add(edge_keys[i]) && !set->add(edge_keys[i]);
+  for (size_t i = 0; i < edge_keys_n; ++i)
+    success = success && set->contains(edge_keys[i]);
+  for (size_t i = 0; i < edge_keys_n; ++i)
+    success = success && set->remove(edge_keys[i]) && !set->remove(edge_keys[i]) && !set->contains(edge_keys[i]);
+  //The list must still be whole
+  success = success && set->add(1) && set->contains(1) && set->remove(1) && !set->contains(1);
+  return TestResult(success);
+}
+
+template <class S>
 static void test_set(Set<int>* p_set)
 {
   working_set = p_set;
 
+  std::cout << "Test Edge Keys...\n" << test_edge_keys<S>() << std::endl;
+
   prepare_shared_data(writers, entries);
-  std::cout << "Test Writers...\n" << test_writers() << std::endl;
+  std::cout << "Test Writers...\n" << test_writers<S>() << std::endl;
   delete[] shared_data;
 
   prepare_shared_data(readers, entries);
-  std::cout << "Test Readers...\n" << test_readers() << std::endl;
+  std::cout << "Test Readers...\n" << test_readers<S>() << std::endl;
+  delete[] shared_data;
+
+  prepare_shared_data(writers, entries);
+  std::cout << "Test Complex...\n" << test_complex<S>() << std::endl;
+  delete[] shared_data;
+
+  prepare_shared_data_fixed(writers, entries);
+  std::cout << "Test Snapshot...\n" << test_snapshot<S>() << std::endl;
   delete[] shared_data;
 
   prepare_shared_data(writers, entries);
-  std::cout << "Test Complex...\n" << test_complex() << std::endl;
+  std::cout << "Test Snapshot Progress...\n" << test_snapshot_progress<S>() << std::endl;
   delete[] shared_data;
+
+  use_batches = true;
+  prepare_shared_data_random(writers, entries);
+  std::cout << "Test Writers (batches)...\n" << test_writers<S>() << std::endl;
+  delete[] shared_data;
+
+  prepare_shared_data_random(readers, entries);
+  std::cout << "Test Readers (batches)...\n" << test_readers<S>() << std::endl;
+  delete[] shared_data;
+
+  prepare_shared_data_random(writers, entries);
+  std::cout << "Test Complex (batches)...\n" << test_complex<S>() << std::endl;
+  delete[] shared_data;
+  use_batches = false;
 }
 
-//Return execution time for test(...) on p_set
-static double test_speed_generic(Set<int>* p_set, TestResult(*test)())
+//Whether the set is selected for the speed test by --sets (comma-separated names)
+static bool is_benchmarked(const char* name)
 {
-  clock_t begin, end;
-  working_set = p_set;
-  begin = clock();
-  for (size_t i = 0; i < tests_n; ++i)
-    test();
-  end = clock();
-  return (double)(end - begin) / CLOCKS_PER_SEC / tests_n;
+  if (benchmarked_sets.empty())
+    return true;
+  std::string sets = "," + benchmarked_sets + ",";
+  return sets.find(std::string(",") + name + ",") != std::string::npos;
 }
 
-//Perform speed test with shared_data building rules in data_creator(...)
-static void test_speed_common(Set<int>* p_set1, Set<int>* p_set2, void(*data_creator)(size_t, size_t))
+//Measure throughput, latency and event counters of every selected set under the same workload
+//(with --sweep for every thread number of the sweep)
+static void test_speed()
 {
-  //Test writers
-  std::cout << "Test Writers" << std::endl;
-  data_creator(writers, entries);
-  std::cout << "FGS: Execution time: " << test_speed_generic(p_set1, test_writers) << std::endl;
-  std::cout << "OS: Execution time: " << test_speed_generic(p_set2, test_writers) << std::endl;
-  delete[] shared_data;
+  Benchmark<int>::set_error_handler(on_error);
+  if (!benchmark_options.threads)
+    benchmark_options.threads = readers + writers;
+  Benchmark<int> benchmark(benchmark_options);
+  std::vector<Benchmark<int>::Result> results;
+  std::vector<size_t> thread_counts = benchmark.thread_counts();
+  for (size_t count = 0; count < thread_counts.size(); ++count)
+    for (size_t i = 0; i < tested_sets_n; ++i)
+      if (is_benchmarked(tested_sets[i].name))
+        results.push_back(tested_sets[i].measure(benchmark, tested_sets[i].name, thread_counts[count]));
+  benchmark.print(results, std::cout);
+
+  if (benchmark_options.image.empty())
+    return;
+  std::vector<Benchmark<int>::RestartResult> restarts;
+  for (size_t i = 0; i < tested_sets_n; ++i)
+    if (is_benchmarked(tested_sets[i].name))
+      restarts.push_back(tested_sets[i].restart(benchmark, tested_sets[i].name));
+  benchmark.print_restart(restarts, std::cout);
+}
 
-  //Test readers
-  std::cout << "Test Readers" << std::endl;
-  data_creator(readers, entries);
-  std::cout << "FGS: Execution time: " << test_speed_generic(p_set1, test_readers) << std::endl;
-  std::cout << "OS: Execution time: " << test_speed_generic(p_set2, test_readers) << std::endl;
-  delete[] shared_data;
+template <class M>
+static M* create_map()
+{
+  M::set_error_handler(on_error);
+  return new M();
+}
 
-  //Test complex
-  std::cout << "Test Complex" << std::endl;
-  data_creator(writers, entries);
-  std::cout << "FGS: Execution time: " << test_speed_generic(p_set1, test_complex) << std::endl;
-  std::cout << "OS: Execution time: " << test_speed_generic(p_set2, test_complex) << std::endl;
-  delete[] shared_data;
+//Compare the concurrent map with a set wrapped in an externally locked side table
+static void test_maps()
+{
+  MapBenchmark<long>::set_error_handler(on_error);
+  MapBenchmark<long> benchmark(benchmark_options);
+  std::vector<MapBenchmark<long>::Result> results;
+  results.push_back(benchmark.run("Map", create_map<TestedMap>));
+  results.push_back(benchmark.run("Map-Locked", create_map<LockedMap<int, long> >));
+  benchmark.print(results, std::cout);
+}
 
+template <class Q>
+static Q* create_queue()
+{
+  Q::set_error_handler(on_error);
+  return new Q();
+}
+
+//Compare the relaxed queue with one heap behind a mutex, writers produce and readers consume
+static void test_queues()
+{
+  QueueBenchmark<int>::set_error_handler(on_error);
+  QueueBenchmark<int> benchmark(benchmark_options, writers, readers);
+  std::vector<QueueBenchmark<int>::Result> results;
+  results.push_back(benchmark.run("MultiQueue", create_queue<TestedQueue>));
+  results.push_back(benchmark.run("Queue-Locked", create_queue<LockedQueue<int> >));
+  benchmark.print(results, std::cout);
 }
 
-static void test_speed(Set<int>* p_set1, Set<int>* p_set2)
+//Parse a benchmark option of the form --name=value (false if it is not valid)
+static bool parse_option(const std::string& option)
 {
-  std::cout << "Randomized" << std::endl;
-  test_speed_common(p_set1, p_set2, prepare_shared_data_random);
-  std::cout << "Fixed" << std::endl;
-  test_speed_common(p_set1, p_set2, prepare_shared_data_fixed);
+  size_t separator = option.find('=');
+  if (option == "--no-tests")
+    run_tests = false;
+  else if (option == "--no-counters")
+    benchmark_options.counters = false;
+  else if (option == "--per-thread")
+    benchmark_options.per_thread = true;
+  else if (option == "--sweep")
+    benchmark_options.sweep = true;
+  else if (option == "--maps")
+    run_maps = true;
+  else if (option == "--queues")
+    run_queues = true;
+  else if (option.compare(0, 2, "--") != 0 || separator == std::string::npos)
+    return false;
+  else
+  {
+    std::string name = option.substr(2, separator - 2);
+    const char* value = option.c_str() + separator + 1;
+    if (name == "threads")
+      benchmark_options.threads = atoi(value);
+    else if (name == "duration")
+      benchmark_options.duration_ms = atoi(value);
+    else if (name == "warmup")
+      benchmark_options.warmup_ms = atoi(value);
+    else if (name == "keys")
+      benchmark_options.key_range = atoi(value);
+    else if (name == "zipf")
+      benchmark_options.zipf_theta = atof(value);
+    else if (name == "batch")
+      benchmark_options.batch = atoi(value);
+    else if (name == "sets")
+      benchmarked_sets = value;
+    else if (name == "image")
+      benchmark_options.image = value;
+    else if (name == "mix")
+      return sscanf(value, "%zu:%zu:%zu", &benchmark_options.read_percent, &benchmark_options.insert_percent,
+        &benchmark_options.delete_percent) == 3;
+    else if (name == "format" && std::string(value) == "text")
+      benchmark_options.format = Benchmark<int>::FORMAT_TEXT;
+    else if (name == "format" && std::string(value) == "csv")
+      benchmark_options.format = Benchmark<int>::FORMAT_CSV;
+    else if (name == "format" && std::string(value) == "json")
+      benchmark_options.format = Benchmark<int>::FORMAT_JSON;
+    else
+      return false;
+  }
+  return true;
 }
 
 int main(int argc, char** argv)
 {
+  const char* usage = "USAGE: app [readers, writers, entries] [--no-tests] [--no-counters] [--per-thread] [--sweep] [--threads=N] [--duration=MS] [--warmup=MS]"
+    " [--mix=READ:INSERT:DELETE] [--keys=N] [--zipf=THETA] [--batch=N] [--sets=NAME,...] [--format=text|csv|json]"
+    " [--image=PATH] [--maps] [--queues]";
   srand(time(NULL));
-  if (argc != 1 && argc != 4)
-    on_error("USAGE: app [readers, writers, entries]");
 
   //Read command-line arguments if there are any
-  if (argc == 4)
+  int positional = 1;
+  while (positional < argc && argv[positional][0] != '-')
+    ++positional;
+  if (positional != 1 && positional != 4)
+    on_error(usage);
+  if (positional == 4)
   {
     readers = atoi(argv[1]);
     writers = atoi(argv[2]);
     entries = atoi(argv[3]);
     if (!readers || !writers || !entries)
-      on_error("USAGE: app [readers, writers, entries]");
+      on_error(usage);
   }
+  benchmark_options.threads = 0; //readers + writers unless --threads is given
+  for (int i = positional; i < argc; ++i)
+    if (!parse_option(argv[i]))
+      on_error(usage);
 
-  //Set error handlers
-  SetFGS<int>::set_error_handler(on_error);
-  SetOS<int>::set_error_handler(on_error);
-
-  //Create sets
-  p_set1 = new SetFGS<int>();
-  p_set2 = new SetOS<int>();
-  if (!p_set1 || !p_set2)
-    on_error("Memory allocation problem");
-
-  //Perform tests
-  std::cout << "\nFine-grained sync set:" << std::endl;
-  test_set(p_set1);
-  std::cout << "\nOptimistic sync set:" << std::endl;
-  test_set(p_set2);
-  std::cout << "\nSpeed test:" << std::endl;
-  test_speed(p_set1, p_set2);
-  delete p_set1;
-  delete p_set2;
+  if (run_tests)
+  {
+    //Create sets
+    for (size_t i = 0; i < tested_sets_n; ++i)
+      if (!(tested_sets[i].p_set = tested_sets[i].create()))
+        on_error("Memory allocation problem");
+
+    //Perform tests
+    for (size_t i = 0; i < tested_sets_n; ++i)
+    {
+      std::cout << "\n" << tested_sets[i].title << ":" << std::endl;
+      tested_sets[i].test(tested_sets[i].p_set);
+    }
+    for (size_t i = 0; i < tested_sets_n; ++i)
+    {
+      delete tested_sets[i].p_set;
+      tested_sets[i].p_set = NULL;
+    }
+
+    prepare_shared_data_random(writers, entries);
+    std::cout << "\nConcurrent map:\nTest Updates...\n" << test_map() << std::endl;
+    delete[] shared_data;
+    prepare_shared_data_random(writers, entries);
+    std::cout << "\nConcurrent priority queue:\nTest Push/Pop...\n" << test_queue() << std::endl;
+    delete[] shared_data;
+    prepare_shared_data_random(writers, entries);
+    std::cout << "\nRead-copy-update set:\nTest Versions...\n" << test_rcu_versions() << std::endl;
+    delete[] shared_data;
+    std::cout << "\nSpeed test:" << std::endl;
+  }
+  test_speed();
+  if (run_maps)
+    test_maps();
+  if (run_queues)
+    test_queues();
   return 0;
 }
@@ -0,0 +1,251 @@
+
+#ifndef MAP_BENCHMARK_HQZRVN__
+#define MAP_BENCHMARK_HQZRVN__
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <string>
+#include <ostream>
+#include <iomanip>
+#include <unordered_map>
+#include <cstdint>
+#include <pthread.h>
+
+#include "set_fgs.hpp"
+#include "benchmark.hpp"
+
+//Map over a set with an external side table: the set keeps the keys and a mutex-protected hash table keeps the
+//values, so every operation that touches a value is serialized by the table mutex (the baseline for ConcurrentMap)
+template <class K, class V>
+class LockedMap
+{
+public:
+  LockedMap()
+  {
+    if (!error_handler) //Error handler needs to be specified before
+      error_handler(g_msg_err_error_handler);
+    if (pthread_mutex_init(&mutex, NULL) != 0)
+      error_handler(g_msg_err_mutex_lock);
+  }
+
+  ~LockedMap()
+  {
+    pthread_mutex_destroy(&mutex);
+  }
+
+  bool insert_or_assign(const K& key, const V& value)
+  {
+    lock();
+    bool added = keys.add(key);
+    values[key] = value;
+    unlock();
+    return added;
+  }
+
+  bool find(const K& key, V& value)
+  {
+    lock();
+    bool found = keys.contains(key);
+    if (found)
+      value = values[key];
+    unlock();
+    return found;
+  }
+
+  bool erase(const K& key)
+  {
+    lock();
+    bool removed = keys.remove(key);
+    values.erase(key);
+    unlock();
+    return removed;
+  }
+
+  V fetch_add(const K& key, const V& delta)
+  {
+    lock();
+    keys.add(key);
+    V& value = values[key];
+    V previous = value;
+    value = previous + delta;
+    unlock();
+    return previous;
+  }
+
+  static void set_error_handler(void(*handler)(const char*))
+  {
+    error_handler = handler;
+    SetFGS<K>::set_error_handler(handler);
+  }
+
+private:
+  SetFGS<K> keys; //Keys
+  std::unordered_map<K, V> values; //Values by key
+  pthread_mutex_t mutex; //Side table lock
+  static void(*error_handler)(const char*); //Fatal errors handler
+
+  void lock()
+  {
+    if (pthread_mutex_lock(&mutex) != 0)
+      error_handler(g_msg_err_mutex_lock);
+  }
+
+  void unlock()
+  {
+    if (pthread_mutex_unlock(&mutex) != 0)
+      error_handler(g_msg_err_mutex_unlock);
+  }
+};
+
+template <class K, class V>
+void(*LockedMap<K, V>::error_handler)(const char*) = nullptr;
+
+//Throughput of concurrent maps with int keys and V values
+//The operation mix of the set benchmark options maps reads to find, inserts to fetch_add and deletes to erase,
+//keys are uniform in [0, key_range). Workers start together after a warm-up as in Benchmark.
+template <class V>
+class MapBenchmark
+{
+public:
+  //Results of one map
+  struct Result
+  {
+    std::string name; //Map name
+    size_t threads; //Worker threads
+    uint64_t operations; //Operations done in the measured phase
+    double seconds; //Measured phase wall time
+
+    double throughput() const
+    {
+      return seconds > 0 ? operations / seconds : 0;
+    }
+  };
+
+  MapBenchmark(const Benchmark<int>::Options& i_options) : options(i_options), phase(PHASE_WARMUP) {}
+
+  //Run the benchmark on a new map made by the factory (M has find, fetch_add and erase)
+  template <class M>
+  Result run(const char* name, M*(*create)())
+  {
+    M* map = create();
+    if (!map)
+      error_handler(g_msg_err_node_create);
+    for (size_t i = 0; i < options.key_range; i += 2)
+      map->fetch_add((int)i, 1);
+
+    std::vector<Worker> workers(options.threads);
+    std::vector<pthread_t> threads(options.threads);
+    phase.store(PHASE_WARMUP);
+    if (pthread_barrier_init(&start_barrier, NULL, (unsigned)options.threads + 1) != 0)
+      error_handler(g_msg_err_benchmark_threads);
+    for (size_t i = 0; i < options.threads; ++i)
+    {
+      workers[i].benchmark = this;
+      workers[i].map = map;
+      workers[i].seed = 0x2545F4914F6CDD1DULL * (i + 1);
+      if (pthread_create(&threads[i], NULL, worker_routine<M>, &workers[i]) != 0)
+        error_handler(g_msg_err_benchmark_threads);
+    }
+
+    pthread_barrier_wait(&start_barrier);
+    std::this_thread::sleep_for(std::chrono::milliseconds(options.warmup_ms));
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    phase.store(PHASE_MEASURE);
+    std::this_thread::sleep_for(std::chrono::milliseconds(options.duration_ms));
+    phase.store(PHASE_STOP);
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < options.threads; ++i)
+      pthread_join(threads[i], NULL);
+    pthread_barrier_destroy(&start_barrier);
+    delete map;
+
+    Result result;
+    result.name = name;
+    result.threads = options.threads;
+    result.operations = 0;
+    result.seconds = std::chrono::duration<double>(end - begin).count();
+    for (size_t i = 0; i < options.threads; ++i)
+      result.operations += workers[i].operations;
+    return result;
+  }
+
+  void print(const std::vector<Result>& results, std::ostream& out) const
+  {
+    out << "Maps (find/fetch_add/erase " << options.read_percent << '/' << options.insert_percent << '/'
+      << options.delete_percent << ", keys: " << options.key_range << ", threads: " << options.threads << "):\n"
+      << std::left << std::setw(12) << "Map" << std::right << std::setw(14) << "ops/sec" << '\n';
+    for (size_t i = 0; i < results.size(); ++i)
+      out << std::left << std::setw(12) << results[i].name << std::right << std::setw(14)
+        << (uint64_t)results[i].throughput() << '\n';
+  }
+
+  static void set_error_handler(void(*handler)(const char*))
+  {
+    error_handler = handler;
+  }
+
+private:
+  enum Phase { PHASE_WARMUP, PHASE_MEASURE, PHASE_STOP };
+
+  //State of a worker thread
+  struct Worker
+  {
+    Worker() : benchmark(nullptr), map(nullptr), seed(0), operations(0) {}
+
+    MapBenchmark* benchmark; //Running benchmark
+    void* map; //Tested map
+    uint64_t seed; //Random generator state
+    uint64_t operations; //Operations done in the measured phase
+    char padding[64]; //Keep hot fields of different workers in different cache lines
+  };
+
+  Benchmark<int>::Options options; //Benchmark parameters
+  std::atomic<int> phase; //Current phase
+  pthread_barrier_t start_barrier; //Releases workers when all of them are ready
+  static void(*error_handler)(const char*); //Fatal errors handler
+
+  //xorshift64*
+  static uint64_t next_random(uint64_t& state)
+  {
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 0x2545F4914F6CDD1DULL;
+  }
+
+  template <class M>
+  static void* worker_routine(void* parameter)
+  {
+    Worker& worker = *reinterpret_cast<Worker*>(parameter);
+    worker.benchmark->template work<M>(worker);
+    pthread_exit(0);
+  }
+
+  template <class M>
+  void work(Worker& worker)
+  {
+    M& map = *static_cast<M*>(worker.map);
+    V value = V();
+    pthread_barrier_wait(&start_barrier);
+    for (int current = phase.load(std::memory_order_relaxed); current != PHASE_STOP; current = phase.load(std::memory_order_relaxed))
+    {
+      size_t operation = next_random(worker.seed) % 100;
+      int key = (int)(next_random(worker.seed) % options.key_range);
+      if (operation < options.read_percent)
+        map.find(key, value);
+      else if (operation < options.read_percent + options.insert_percent)
+        map.fetch_add(key, 1);
+      else
+        map.erase(key);
+      if (current == PHASE_MEASURE)
+        ++worker.operations;
+    }
+  }
+};
+
+template <class V>
+void(*MapBenchmark<V>::error_handler)(const char*) = nullptr;
+
+#endif
@@ -0,0 +1,193 @@
+
+#ifndef NODE_ALLOC_VBNQZS__
+#define NODE_ALLOC_VBNQZS__
+
+#include <new>
+#include <vector>
+#include <cstdlib>
+#include <pthread.h>
+
+//Node allocation policies for list-based sets
+//Every policy has allocate<Size>() returning nullptr on failure and deallocate<Size>(block).
+
+//Global operator new
+class AllocDefault
+{
+public:
+  template <size_t Size>
+  static void* allocate()
+  {
+    return ::operator new(Size, std::nothrow);
+  }
+
+  template <size_t Size>
+  static void deallocate(void* block)
+  {
+    ::operator delete(block);
+  }
+};
+
+//Thread-caching pool of cache-line aligned blocks
+//Every thread allocates from and frees to its own cache. Blocks move between thread caches and
+//a central list in batches, new blocks are carved out of slabs that are kept until the process exits.
+class AllocPool
+{
+public:
+  static const size_t CACHE_LINE = 64; //Block alignment
+  static const size_t BATCH = 64; //Blocks moved between a thread cache and the central list at once
+  static const size_t SLAB_BATCHES = 16; //Batches carved out of one slab
+
+  template <size_t Size>
+  static void* allocate()
+  {
+    return Pool<Size>::allocate();
+  }
+
+  template <size_t Size>
+  static void deallocate(void* block)
+  {
+    Pool<Size>::deallocate(block);
+  }
+
+private:
+  //Free block (the memory of the block itself)
+  struct FreeBlock
+  {
+    FreeBlock* next; //Next free block
+  };
+
+  //Chain of free blocks
+  struct Batch
+  {
+    FreeBlock* head; //First block
+    size_t count; //Blocks number
+  };
+
+  //Pool of blocks of one size
+  template <size_t Size>
+  class Pool
+  {
+  public:
+    static void* allocate()
+    {
+      ThreadCache& cache = get_cache();
+      if (!cache.free.head && !refill(cache))
+        return nullptr;
+      FreeBlock* block = cache.free.head;
+      cache.free.head = block->next;
+      --cache.free.count;
+      return block;
+    }
+
+    static void deallocate(void* block)
+    {
+      if (!block)
+        return;
+      ThreadCache& cache = get_cache();
+      FreeBlock* free_block = static_cast<FreeBlock*>(block);
+      free_block->next = cache.free.head;
+      cache.free.head = free_block;
+      //Return a batch to the central list if the cache has grown too much
+      if (++cache.free.count >= 2 * BATCH)
+        cache.return_batch(BATCH);
+    }
+
+  private:
+    static const size_t BLOCK_SIZE = (Size + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+
+    //Central list of batches shared by all threads
+    struct Central
+    {
+      Central() : mutex(PTHREAD_MUTEX_INITIALIZER) {}
+
+      ~Central()
+      {
+        for (size_t i = 0; i < slabs.size(); ++i)
+          free(slabs[i]);
+      }
+
+      pthread_mutex_t mutex; //Mutex for the central list
+      std::vector<Batch> batches; //Free batches
+      std::vector<void*> slabs; //Allocated slabs
+    };
+
+    //Free blocks of a thread
+    struct ThreadCache
+    {
+      ThreadCache()
+      {
+        free.head = nullptr;
+        free.count = 0;
+      }
+
+      ~ThreadCache()
+      {
+        return_batch(free.count);
+      }
+
+      //Move `count` blocks from the head of the cache to the central list
+      void return_batch(size_t count)
+      {
+        if (!count)
+          return;
+        Batch batch = { free.head, count };
+        FreeBlock* last = free.head;
+        for (size_t i = 1; i < count; ++i)
+          last = last->next;
+        free.head = last->next;
+        free.count -= count;
+        last->next = nullptr;
+
+        Central& central = get_central();
+        pthread_mutex_lock(&central.mutex);
+        central.batches.push_back(batch);
+        pthread_mutex_unlock(&central.mutex);
+      }
+
+      Batch free; //Free blocks of the thread
+    };
+
+    static Central& get_central()
+    {
+      static Central central;
+      return central;
+    }
+
+    static ThreadCache& get_cache()
+    {
+      static thread_local ThreadCache cache;
+      return cache;
+    }
+
+    //Take a batch from the central list or carve a new slab
+    static bool refill(ThreadCache& cache)
+    {
+      Central& central = get_central();
+      pthread_mutex_lock(&central.mutex);
+      if (central.batches.empty())
+      {
+        void* slab = nullptr;
+        if (posix_memalign(&slab, CACHE_LINE, BLOCK_SIZE * BATCH * SLAB_BATCHES) != 0)
+        {
+          pthread_mutex_unlock(&central.mutex);
+          return false;
+        }
+        central.slabs.push_back(slab);
+        char* block = static_cast<char*>(slab);
+        for (size_t i = 0; i < SLAB_BATCHES; ++i)
+        {
+          Batch batch = { reinterpret_cast<FreeBlock*>(block), BATCH };
+          for (size_t j = 0; j < BATCH; ++j, block += BLOCK_SIZE)
+            reinterpret_cast<FreeBlock*>(block)->next = j + 1 < BATCH ? reinterpret_cast<FreeBlock*>(block + BLOCK_SIZE) : nullptr;
+          central.batches.push_back(batch);
+        }
+      }
+      cache.free = central.batches.back();
+      central.batches.pop_back();
+      pthread_mutex_unlock(&central.mutex);
+      return true;
+    }
+  };
+};
+
+#endif
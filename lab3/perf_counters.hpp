@@ -0,0 +1,142 @@
+
+#ifndef PERF_COUNTERS_RNWKTB__
+#define PERF_COUNTERS_RNWKTB__
+
+#include <cstdint>
+#include <cstring>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <linux/perf_event.h>
+
+//Event counters of the calling thread (perf_event_open)
+//Every event is opened on its own, so the ones the kernel or the hardware does not provide (or the
+//perf_event_paranoid level forbids) are reported as unavailable without affecting the rest.
+//Context switches fall back to getrusage(RUSAGE_THREAD) if the software event cannot be opened.
+class PerfCounters
+{
+public:
+  enum Event { CYCLES, INSTRUCTIONS, LLC_MISSES, BRANCH_MISSES, CONTEXT_SWITCHES, EVENTS };
+
+  //Counted values of all events
+  struct Values
+  {
+    Values()
+    {
+      for (size_t i = 0; i < EVENTS; ++i)
+      {
+        value[i] = 0;
+        available[i] = true;
+      }
+    }
+
+    //Accumulate values of another thread (an event is available if it is available in both)
+    void add(const Values& other)
+    {
+      for (size_t i = 0; i < EVENTS; ++i)
+      {
+        value[i] += other.value[i];
+        available[i] = available[i] && other.available[i];
+      }
+    }
+
+    uint64_t value[EVENTS]; //Event counts
+    bool available[EVENTS]; //Whether the event was counted
+  };
+
+  PerfCounters() : rusage_switches(0)
+  {
+    static const uint32_t types[EVENTS] = { PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE,
+      PERF_TYPE_HARDWARE, PERF_TYPE_SOFTWARE };
+    static const uint64_t configs[EVENTS] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+      PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_SW_CONTEXT_SWITCHES };
+    for (size_t i = 0; i < EVENTS; ++i)
+      //Context switches happen in the kernel, counting only user mode would always give zero
+      fds[i] = open_event(types[i], configs[i], i != CONTEXT_SWITCHES);
+  }
+
+  ~PerfCounters()
+  {
+    for (size_t i = 0; i < EVENTS; ++i)
+      if (fds[i] >= 0)
+        close(fds[i]);
+  }
+
+  //Reset and start counting
+  void start()
+  {
+    for (size_t i = 0; i < EVENTS; ++i)
+      if (fds[i] >= 0)
+      {
+        ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+      }
+    if (fds[CONTEXT_SWITCHES] < 0)
+      rusage_switches = thread_switches();
+  }
+
+  //Stop counting and get values counted since start()
+  void stop(Values& values)
+  {
+    for (size_t i = 0; i < EVENTS; ++i)
+      if (fds[i] >= 0)
+        ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+    for (size_t i = 0; i < EVENTS; ++i)
+    {
+      values.value[i] = 0;
+      values.available[i] = fds[i] >= 0 && read_event(fds[i], values.value[i]);
+    }
+    if (fds[CONTEXT_SWITCHES] < 0)
+    {
+      values.value[CONTEXT_SWITCHES] = thread_switches() - rusage_switches;
+      values.available[CONTEXT_SWITCHES] = true;
+    }
+  }
+
+  static const char* name(Event event)
+  {
+    static const char* names[EVENTS] = { "cycles", "instructions", "llc_misses", "branch_misses", "context_switches" };
+    return names[event];
+  }
+
+private:
+  int fds[EVENTS]; //Event descriptors (-1 if the event is unavailable)
+  uint64_t rusage_switches; //Context switches by getrusage at start()
+
+  static int open_event(uint32_t type, uint64_t config, bool user_only)
+  {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = user_only ? 1 : 0;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+  }
+
+  //Read an event scaling it up if the kernel multiplexed it with other events
+  static bool read_event(int fd, uint64_t& value)
+  {
+    uint64_t data[3]; //Value, time enabled, time running
+    if (read(fd, data, sizeof(data)) != (ssize_t)sizeof(data))
+      return false;
+    value = data[0];
+    if (data[2] && data[2] < data[1])
+      value = (uint64_t)((double)data[0] * data[1] / data[2]);
+    return true;
+  }
+
+  static uint64_t thread_switches()
+  {
+    rusage usage;
+    if (getrusage(RUSAGE_THREAD, &usage) != 0)
+      return 0;
+    return usage.ru_nvcsw + usage.ru_nivcsw;
+  }
+};
+
+#endif
@@ -0,0 +1,244 @@
+
+#ifndef PRIORITY_QUEUE_MKVQZD__
+#define PRIORITY_QUEUE_MKVQZD__
+
+#include <functional>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include <bits/stdc++.h>
+
+#include "set.h"
+#include "locks.hpp"
+
+//Relaxed concurrent priority queue (MultiQueue): elements are spread over several binary heaps, each behind
+//its own spinlock. The priority of an element is its key (hash) as in the sets, the smallest key goes first.
+//push puts the element into a random heap; pop_min looks at the cached minimums of two random heaps and
+//takes from the smaller one, so consumers do not meet on one head node as with a list set used as a queue.
+//The order is relaxed: a popped element is close to the minimum (among the smallest few per heap),
+//not necessarily the minimum. Duplicates are allowed.
+template <class T>
+class MultiQueue
+{
+public:
+  static const size_t CACHE_LINE = 64; //Padding between heaps
+  static const size_t PUSH_ATTEMPTS = 4; //Random heaps tried with try_lock before a push waits for a lock
+  static const size_t POP_ATTEMPTS = 8; //Random heap pairs tried before pop_min sweeps all heaps
+
+  //Number of heaps (2 per hardware thread unless given)
+  explicit MultiQueue(size_t queues_num = 0) : heaps_num(queues_num ? queues_num : 2 * std::thread::hardware_concurrency())
+  {
+    if (!error_handler) //Error handler needs to be specified before
+      error_handler(g_msg_err_error_handler);
+    if (heaps_num < 2)
+      heaps_num = 2;
+    heaps = new Heap[heaps_num];
+    if (!heaps)
+      error_handler(g_msg_err_node_create);
+  }
+
+  ~MultiQueue()
+  {
+    delete[] heaps;
+  }
+
+  void push(const T& item)
+  {
+    insert_item(item);
+  }
+
+  void push(T&& item)
+  {
+    insert_item(std::move(item));
+  }
+
+  //Take an element with a small key (false if every heap was empty when it was visited)
+  bool pop_min(T& out)
+  {
+    for (size_t attempt = 0; attempt < POP_ATTEMPTS; ++attempt)
+    {
+      Heap* first = &heaps[random_index()];
+      Heap* second = &heaps[random_index()];
+      size_t first_size = first->size.load(std::memory_order_relaxed);
+      size_t second_size = second->size.load(std::memory_order_relaxed);
+      Heap* chosen = nullptr;
+      if (first_size && second_size)
+        chosen = first->top.load(std::memory_order_relaxed) <= second->top.load(std::memory_order_relaxed) ? first : second;
+      else if (first_size || second_size)
+        chosen = first_size ? first : second;
+      if (chosen && chosen->lock.try_lock())
+      {
+        bool taken = take(*chosen, out);
+        unlock(*chosen);
+        if (taken)
+          return true;
+      }
+      stats.add(SetStats::RETRIES);
+    }
+
+    //Heaps look empty or busy: visit all of them in turn
+    size_t start = random_index();
+    for (size_t i = 0; i < heaps_num; ++i)
+    {
+      Heap& heap = heaps[(start + i) % heaps_num];
+      if (!heap.size.load(std::memory_order_relaxed))
+        continue;
+      lock(heap);
+      bool taken = take(heap, out);
+      unlock(heap);
+      if (taken)
+        return true;
+    }
+    return false;
+  }
+
+  //Number of elements (exact only when nobody pushes or pops)
+  size_t size() const
+  {
+    size_t result = 0;
+    for (size_t i = 0; i < heaps_num; ++i)
+      result += heaps[i].size.load(std::memory_order_relaxed);
+    return result;
+  }
+
+  bool empty() const
+  {
+    return size() == 0;
+  }
+
+  //Contention statistics since creation or the last reset (zeros unless built with SET_STATS, see set_stats.hpp)
+  SetStatistics statistics() const
+  {
+    return stats.get();
+  }
+
+  void reset_statistics()
+  {
+    stats.reset();
+  }
+
+  static void set_error_handler(void(*handler)(const char*))
+  {
+    error_handler = handler;
+  }
+
+private:
+  //Element of a heap
+  struct Entry
+  {
+    size_t key; //Data key (hash)
+    T item; //Raw data
+  };
+
+  //Heap order: the entry with the smallest key at the front
+  struct EntryAfter
+  {
+    bool operator()(const Entry& left, const Entry& right) const
+    {
+      return left.key > right.key;
+    }
+  };
+
+  //Binary min-heap with its lock
+  struct Heap
+  {
+    Heap() : top(0), size(0) {}
+
+    LockTTAS lock; //Heap lock (try_lock lets a thread go to another heap instead of waiting)
+    std::vector<Entry> entries; //Heap of elements (with the lock held)
+    std::atomic<size_t> top; //Smallest key, read without the lock to pick a heap
+    std::atomic<size_t> size; //Number of elements, read without the lock
+    char padding[CACHE_LINE]; //Keep heaps of different locks in different cache lines
+  };
+
+  size_t heaps_num; //Number of heaps
+  Heap* heaps; //Heaps
+  SetStats stats; //Contention statistics (see set_stats.hpp)
+  static void(*error_handler)(const char*); //Fatal errors handler
+
+  MultiQueue(const MultiQueue&) = delete;
+  MultiQueue& operator=(const MultiQueue&) = delete;
+
+  //Random heap index from a per-thread xorshift64* generator
+  size_t random_index()
+  {
+    static thread_local uint64_t state = 0;
+    if (!state)
+      state = std::hash<std::thread::id>()(std::this_thread::get_id()) | 1;
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return (size_t)((state * 0x2545F4914F6CDD1DULL) >> 32) % heaps_num;
+  }
+
+  void lock(Heap& heap)
+  {
+    SetStats::LockTiming timing(stats);
+    if (!heap.lock.lock())
+      error_handler(g_msg_err_mutex_lock);
+  }
+
+  void unlock(Heap& heap)
+  {
+    if (!heap.lock.unlock())
+      error_handler(g_msg_err_mutex_unlock);
+  }
+
+  //Publish the minimum and the size of a heap (called with its lock held)
+  static void update(Heap& heap)
+  {
+    if (!heap.entries.empty())
+      heap.top.store(heap.entries.front().key, std::memory_order_relaxed);
+    heap.size.store(heap.entries.size(), std::memory_order_relaxed);
+  }
+
+  //Move the minimum of a locked heap out (false if it is empty)
+  static bool take(Heap& heap, T& out)
+  {
+    if (heap.entries.empty())
+      return false;
+    std::pop_heap(heap.entries.begin(), heap.entries.end(), EntryAfter());
+    out = std::move(heap.entries.back().item);
+    heap.entries.pop_back();
+    update(heap);
+    return true;
+  }
+
+  //Add an element copied or moved into a random heap, a busy heap is skipped a few times before waiting
+  template <class U>
+  void insert_item(U&& item)
+  {
+    Entry entry = { generate_hash(item), std::forward<U>(item) };
+    for (size_t attempt = 0; ; ++attempt)
+    {
+      Heap& heap = heaps[random_index()];
+      if (attempt < PUSH_ATTEMPTS)
+      {
+        if (!heap.lock.try_lock())
+        {
+          stats.add(SetStats::RETRIES);
+          continue;
+        }
+      }
+      else
+        lock(heap);
+      heap.entries.push_back(std::move(entry));
+      std::push_heap(heap.entries.begin(), heap.entries.end(), EntryAfter());
+      update(heap);
+      unlock(heap);
+      return;
+    }
+  }
+
+  size_t generate_hash(const T& item)
+  {
+    return std::hash<T>()(item);
+  }
+};
+
+template <class T>
+void(*MultiQueue<T>::error_handler)(const char*) = nullptr;
+
+#endif
@@ -0,0 +1,273 @@
+
+#ifndef QUEUE_BENCHMARK_RZCWLT__
+#define QUEUE_BENCHMARK_RZCWLT__
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <string>
+#include <ostream>
+#include <iomanip>
+#include <algorithm>
+#include <functional>
+#include <cstdint>
+#include <pthread.h>
+
+#include "set.h"
+#include "benchmark.hpp"
+
+//Priority queue behind one mutex: every push and pop_min serializes on it and consumers always meet
+//at the same minimum, as with a list set used as a queue (the baseline for MultiQueue)
+template <class T>
+class LockedQueue
+{
+public:
+  LockedQueue()
+  {
+    if (!error_handler) //Error handler needs to be specified before
+      error_handler(g_msg_err_error_handler);
+    if (pthread_mutex_init(&mutex, NULL) != 0)
+      error_handler(g_msg_err_mutex_lock);
+  }
+
+  ~LockedQueue()
+  {
+    pthread_mutex_destroy(&mutex);
+  }
+
+  void push(const T& item)
+  {
+    Entry entry = { std::hash<T>()(item), item };
+    lock();
+    entries.push_back(entry);
+    std::push_heap(entries.begin(), entries.end(), EntryAfter());
+    unlock();
+  }
+
+  bool pop_min(T& out)
+  {
+    lock();
+    bool taken = !entries.empty();
+    if (taken)
+    {
+      std::pop_heap(entries.begin(), entries.end(), EntryAfter());
+      out = entries.back().item;
+      entries.pop_back();
+    }
+    unlock();
+    return taken;
+  }
+
+  static void set_error_handler(void(*handler)(const char*))
+  {
+    error_handler = handler;
+  }
+
+private:
+  struct Entry
+  {
+    size_t key; //Data key (hash)
+    T item; //Raw data
+  };
+
+  struct EntryAfter
+  {
+    bool operator()(const Entry& left, const Entry& right) const
+    {
+      return left.key > right.key;
+    }
+  };
+
+  std::vector<Entry> entries; //Binary min-heap
+  pthread_mutex_t mutex; //Queue lock
+  static void(*error_handler)(const char*); //Fatal errors handler
+
+  void lock()
+  {
+    if (pthread_mutex_lock(&mutex) != 0)
+      error_handler(g_msg_err_mutex_lock);
+  }
+
+  void unlock()
+  {
+    if (pthread_mutex_unlock(&mutex) != 0)
+      error_handler(g_msg_err_mutex_unlock);
+  }
+};
+
+template <class T>
+void(*LockedQueue<T>::error_handler)(const char*) = nullptr;
+
+//Throughput of concurrent priority queues of T (made from ints) with separate producer and consumer threads
+//Producers push keys uniform in [0, key_range), consumers call pop_min, the queue is prefilled with
+//key_range / 2 elements so consumers do not start on an empty queue. Duration and warm-up come from
+//the set benchmark options, workers start together after a warm-up as in Benchmark.
+template <class T>
+class QueueBenchmark
+{
+public:
+  //Results of one queue
+  struct Result
+  {
+    std::string name; //Queue name
+    size_t producers; //Producer threads
+    size_t consumers; //Consumer threads
+    uint64_t pushes; //Elements pushed in the measured phase
+    uint64_t pops; //Elements popped in the measured phase
+    uint64_t empty_pops; //pop_min calls that found the queue empty
+    double seconds; //Measured phase wall time
+
+    double throughput() const
+    {
+      return seconds > 0 ? (pushes + pops) / seconds : 0;
+    }
+  };
+
+  QueueBenchmark(const Benchmark<int>::Options& i_options, size_t i_producers, size_t i_consumers)
+    : options(i_options), producers(i_producers), consumers(i_consumers), phase(PHASE_WARMUP) {}
+
+  //Run the benchmark on a new queue made by the factory (Q has push and pop_min)
+  template <class Q>
+  Result run(const char* name, Q*(*create)())
+  {
+    Q* queue = create();
+    if (!queue)
+      error_handler(g_msg_err_node_create);
+    uint64_t seed = 0x9E3779B97F4A7C15ULL;
+    for (size_t i = 0; i < options.key_range / 2; ++i)
+      queue->push((T)(next_random(seed) % options.key_range));
+
+    size_t threads_num = producers + consumers;
+    std::vector<Worker> workers(threads_num);
+    std::vector<pthread_t> threads(threads_num);
+    phase.store(PHASE_WARMUP);
+    if (pthread_barrier_init(&start_barrier, NULL, (unsigned)threads_num + 1) != 0)
+      error_handler(g_msg_err_benchmark_threads);
+    for (size_t i = 0; i < threads_num; ++i)
+    {
+      workers[i].benchmark = this;
+      workers[i].queue = queue;
+      workers[i].producer = i < producers;
+      workers[i].seed = 0x2545F4914F6CDD1DULL * (i + 1);
+      if (pthread_create(&threads[i], NULL, worker_routine<Q>, &workers[i]) != 0)
+        error_handler(g_msg_err_benchmark_threads);
+    }
+
+    pthread_barrier_wait(&start_barrier);
+    std::this_thread::sleep_for(std::chrono::milliseconds(options.warmup_ms));
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    phase.store(PHASE_MEASURE);
+    std::this_thread::sleep_for(std::chrono::milliseconds(options.duration_ms));
+    phase.store(PHASE_STOP);
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < threads_num; ++i)
+      pthread_join(threads[i], NULL);
+    pthread_barrier_destroy(&start_barrier);
+    delete queue;
+
+    Result result;
+    result.name = name;
+    result.producers = producers;
+    result.consumers = consumers;
+    result.pushes = 0;
+    result.pops = 0;
+    result.empty_pops = 0;
+    result.seconds = std::chrono::duration<double>(end - begin).count();
+    for (size_t i = 0; i < threads_num; ++i)
+    {
+      result.pushes += workers[i].pushes;
+      result.pops += workers[i].pops;
+      result.empty_pops += workers[i].empty_pops;
+    }
+    return result;
+  }
+
+  void print(const std::vector<Result>& results, std::ostream& out) const
+  {
+    out << "Priority queues (producers: " << producers << ", consumers: " << consumers << ", keys: " << options.key_range << "):\n"
+      << std::left << std::setw(14) << "Queue" << std::right << std::setw(14) << "ops/sec" << std::setw(14) << "pushes/sec"
+      << std::setw(14) << "pops/sec" << std::setw(14) << "empty pops" << '\n';
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+      const Result& result = results[i];
+      double seconds = result.seconds > 0 ? result.seconds : 1;
+      out << std::left << std::setw(14) << result.name << std::right << std::setw(14) << (uint64_t)result.throughput()
+        << std::setw(14) << (uint64_t)(result.pushes / seconds) << std::setw(14) << (uint64_t)(result.pops / seconds)
+        << std::setw(14) << result.empty_pops << '\n';
+    }
+  }
+
+  static void set_error_handler(void(*handler)(const char*))
+  {
+    error_handler = handler;
+  }
+
+private:
+  enum Phase { PHASE_WARMUP, PHASE_MEASURE, PHASE_STOP };
+
+  //State of a worker thread
+  struct Worker
+  {
+    Worker() : benchmark(nullptr), queue(nullptr), producer(false), seed(0), pushes(0), pops(0), empty_pops(0) {}
+
+    QueueBenchmark* benchmark; //Running benchmark
+    void* queue; //Tested queue
+    bool producer; //Whether the worker pushes or pops
+    uint64_t seed; //Random generator state
+    uint64_t pushes; //Elements pushed in the measured phase
+    uint64_t pops; //Elements popped in the measured phase
+    uint64_t empty_pops; //Empty pops in the measured phase
+    char padding[64]; //Keep hot fields of different workers in different cache lines
+  };
+
+  Benchmark<int>::Options options; //Benchmark parameters
+  size_t producers; //Producer threads
+  size_t consumers; //Consumer threads
+  std::atomic<int> phase; //Current phase
+  pthread_barrier_t start_barrier; //Releases workers when all of them are ready
+  static void(*error_handler)(const char*); //Fatal errors handler
+
+  //xorshift64*
+  static uint64_t next_random(uint64_t& state)
+  {
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 0x2545F4914F6CDD1DULL;
+  }
+
+  template <class Q>
+  static void* worker_routine(void* parameter)
+  {
+    Worker& worker = *reinterpret_cast<Worker*>(parameter);
+    worker.benchmark->template work<Q>(worker);
+    pthread_exit(0);
+  }
+
+  template <class Q>
+  void work(Worker& worker)
+  {
+    Q& queue = *static_cast<Q*>(worker.queue);
+    T item = T();
+    pthread_barrier_wait(&start_barrier);
+    for (int current = phase.load(std::memory_order_relaxed); current != PHASE_STOP; current = phase.load(std::memory_order_relaxed))
+    {
+      bool measured = current == PHASE_MEASURE;
+      if (worker.producer)
+      {
+        queue.push((T)(next_random(worker.seed) % options.key_range));
+        worker.pushes += measured;
+      }
+      else if (queue.pop_min(item))
+        worker.pops += measured;
+      else
+        worker.empty_pops += measured;
+    }
+  }
+};
+
+template <class T>
+void(*QueueBenchmark<T>::error_handler)(const char*) = nullptr;
+
+#endif
@@ -1,6 +1,14 @@
 #ifndef SET_KFOEFV__
 #define SET_KFOEFV__
 
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+
+#include "set_stats.hpp"
+
 //Error messages
 static const char* g_msg_err_mutex_lock = "Mutex lock error";
 static const char* g_msg_err_mutex_unlock = "Mutex unlock error";
@@ -12,15 +20,169 @@ template <class T>
 class Set
 {
 public:
+  typedef T value_type;
+
   virtual ~Set() {}
 
   //Add an element (true if was added)
 	virtual bool add(const T& item) = 0;
+  //Add an element moving it into the set (it is left as is if it was not added)
+  virtual bool add(T&& item) = 0;
 	//Remove an element (true if was deleted)
   virtual bool remove(const T& item) = 0;
   //Check whether an element is in the set
 	virtual bool contains(const T& item) = 0;
+
+  //Add an element built from the arguments (true if was added)
+  //The key is the hash of the element, so it is built before its position is known and moved into the set.
+  template <class... Args>
+  bool emplace(Args&&... args)
+  {
+    return add(T(std::forward<Args>(args)...));
+  }
+
+  //Add elements of the range (number of added elements)
+  virtual size_t add_all(const T* begin, const T* end) = 0;
+  //Remove elements of the range (number of deleted elements)
+  virtual size_t remove_all(const T* begin, const T* end) = 0;
+  //Check whether elements of the range are in the set (out[i] is set for begin[i])
+  virtual void contains_all(const T* begin, const T* end, bool* out) = 0;
+
+  //Callback for elements reported by range queries
+  typedef void(*ItemCallback)(const T& item, void* context);
+
+  //Copy all elements in key order as of one point in time
+  void snapshot(std::vector<T>& out)
+  {
+    collect(0, SIZE_MAX, out);
+  }
+
+  //Call callback for every element with key in [key(lo), key(hi)] in key order as of one point in time
+  //(number of elements, the callback runs after the collection so it does not delay writers)
+  size_t range(const T& lo, const T& hi, ItemCallback callback, void* context)
+  {
+    std::vector<T> items;
+    collect(std::hash<T>()(lo), std::hash<T>()(hi), items);
+    for (size_t i = 0; i < items.size(); ++i)
+      callback(items[i], context);
+    return items.size();
+  }
+
+  //Contention statistics since creation or the last reset (zeros unless built with SET_STATS, see set_stats.hpp)
+  virtual SetStatistics statistics() const
+  {
+    return SetStatistics();
+  }
+
+  //Reset contention statistics
+  virtual void reset_statistics() {}
+
+protected:
+  //Copy elements with keys in [lo_key, hi_key] in key order as of one point in time
+  virtual void collect(size_t lo_key, size_t hi_key, std::vector<T>& out) = 0;
+
+  //Collect elements of another set (for sets built of other sets)
+  static void collect_from(Set<T>& set, size_t lo_key, size_t hi_key, std::vector<T>& out)
+  {
+    set.collect(lo_key, hi_key, out);
+  }
+
+  //Give the element of a node that was built but not linked back to the argument of add: an rvalue gets its
+  //value back (it is left as is if it was not added), an lvalue was only copied
+  static void give_back(T&& item, T& built)
+  {
+    item = std::move(built);
+  }
+
+  static void give_back(const T&, T&) {}
+
+  //Batch element: key (hash) and index in the range
+  typedef std::pair<size_t, size_t> BatchEntry;
+
+  //Sort elements of a range by key so the batch can be applied in one traversal
+  static void sort_batch(const T* begin, const T* end, std::vector<BatchEntry>& batch)
+  {
+    batch.clear();
+    batch.reserve(end - begin);
+    for (const T* item = begin; item != end; ++item)
+      batch.push_back(BatchEntry(std::hash<T>()(*item), item - begin));
+    std::sort(batch.begin(), batch.end());
+  }
+
+  //Sort elements of a range by key and elements with equal keys by the comparator (for sets ordered by (key, element))
+  template <class Compare>
+  static void sort_batch(const T* begin, const T* end, std::vector<BatchEntry>& batch, Compare compare)
+  {
+    sort_batch(begin, end, batch);
+    BatchOrder<Compare> order = { begin, compare };
+    for (size_t first = 0, last = 0; first < batch.size(); first = last)
+    {
+      for (last = first + 1; last < batch.size() && batch[last].first == batch[first].first; ++last);
+      if (last - first > 1)
+        std::sort(batch.begin() + first, batch.begin() + last, order);
+    }
+  }
+
+private:
+  //Order of batch elements with equal keys
+  template <class Compare>
+  struct BatchOrder
+  {
+    const T* items; //Elements of the batch
+    Compare compare; //Elements order
+
+    bool operator()(const BatchEntry& left, const BatchEntry& right) const
+    {
+      return compare(items[left.second], items[right.second]);
+    }
+  };
 };
 
-#endif
+//Base of the set implementations (CRTP, Derived is the set class and is final)
+//Code instantiated for a set type calls the operations of Derived directly, so they are bound at compile
+//time and can be inlined into the caller's loop. Code that only has a Set<T> pointer goes through the virtual table.
+template <class T, class Derived>
+class SetBase : public Set<T>
+{
+public:
+  template <class... Args>
+  bool emplace(Args&&... args)
+  {
+    return derived().add(T(std::forward<Args>(args)...));
+  }
+
+  //Add elements of the range (number of added elements)
+  size_t add_all(const T* begin, const T* end)
+  {
+    size_t added = 0;
+    for (const T* item = begin; item != end; ++item)
+      if (derived().add(*item))
+        ++added;
+    return added;
+  }
+
+  //Remove elements of the range (number of deleted elements)
+  size_t remove_all(const T* begin, const T* end)
+  {
+    size_t removed = 0;
+    for (const T* item = begin; item != end; ++item)
+      if (derived().remove(*item))
+        ++removed;
+    return removed;
+  }
+
+  //Check whether elements of the range are in the set (out[i] is set for begin[i])
+  void contains_all(const T* begin, const T* end, bool* out)
+  {
+    for (const T* item = begin; item != end; ++item)
+      out[item - begin] = derived().contains(*item);
+  }
 
+private:
+  Derived& derived()
+  {
+    return static_cast<Derived&>(*this);
+  }
+};
+
+#endif
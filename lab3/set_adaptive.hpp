@@ -0,0 +1,545 @@
+
+#ifndef SET_ADAPTIVE_RVQMXC__
+#define SET_ADAPTIVE_RVQMXC__
+
+#include <functional>
+#include <atomic>
+#include <vector>
+#include <set>
+#include <pthread.h>
+#include <bits/stdc++.h>
+
+#include "set.h"
+#include "set_os.hpp"
+#include "epoch.hpp"
+#include "locks.hpp"
+
+//Contention-adaptive set: switches at runtime between a coarse-locked mode and a fine-grained one
+//In the coarse mode the elements are in a sequential tree under one mutex, so an operation takes one lock and
+//no node locks. In the fine mode they are in an optimistic list (SetOS with the Lock policy and Compare).
+//The mode follows contention statistics, which this set always counts (with or without SET_STATS): the coarse
+//mutex acquisitions that found it held (counted as retries), and the validation failures (retries) and node lock
+//waits of the fine set. Every DECISION_PERIOD-th operation of a thread looks at the statistics since the last
+//decision once they cover a window of operations: at least TO_FINE_CONTENDED_PERCENT contended acquisitions out
+//of WINDOW_OPERATIONS move the set to the fine mode (a share, unlike the wait time, is not dominated by a
+//preempted holder), at most TO_COARSE_RETRY_PERCENT retries per search with an average node lock wait of at
+//most TO_COARSE_WAIT_NS over fine_window searches move it back. A quiet fine set
+//does not tell how contended the mutex would be, so if the coarse mode is left again within BOUNCE_DECISIONS
+//decisions fine_window doubles (up to MAX_WINDOW_OPERATIONS), and every later decision to stay halves it.
+//Operations run in critical sections of the mode domain (a store and a fence to the thread's own record, no
+//read-modify-write). A migration stops new operations, waits for a grace period and moves every element to
+//the other mode, so no element is lost or duplicated.
+template <class T, class Lock = LockMutex, class Compare = std::less<T> >
+class SetAdaptive final : public SetBase<T, SetAdaptive<T, Lock, Compare> >
+{
+public:
+  enum Mode { MODE_COARSE, MODE_FINE };
+
+  static const size_t DECISION_PERIOD = 1024; //Operations of a thread between looks at the statistics
+  static const uint64_t WINDOW_OPERATIONS = 4096; //Lock acquisitions (coarse) or searches (fine) per decision
+  static const uint64_t MAX_WINDOW_OPERATIONS = WINDOW_OPERATIONS << 8; //Longest fine mode window
+  static const size_t BOUNCE_DECISIONS = 16; //Coarse mode decisions after which leaving it is not a bounce
+  static const uint64_t TO_FINE_CONTENDED_PERCENT = 25; //Acquisitions that find the coarse mutex held to leave the coarse mode
+  static const uint64_t TO_COARSE_WAIT_NS = 200; //Average node lock wait to leave the fine mode
+  static const uint64_t TO_COARSE_RETRY_PERCENT = 1; //Retries per search to leave the fine mode
+
+  typedef BasicSetStats<true> Stats;
+  typedef SetOS<T, Lock, AllocDefault, Compare, Stats> Fine;
+
+  SetAdaptive() : mode(MODE_COARSE), fine(nullptr), blocked(false), migrating(false), fine_window(WINDOW_OPERATIONS),
+    coarse_decisions(BOUNCE_DECISIONS), switches(0)
+  {
+    if (!error_handler) //Error handler needs to be specified before
+      error_handler(g_msg_err_error_handler);
+    if (pthread_mutex_init(&coarse_mutex, NULL) != 0)
+      error_handler(g_msg_err_mutex_lock);
+  }
+
+  ~SetAdaptive()
+  {
+    delete fine.load(std::memory_order_relaxed);
+    pthread_mutex_destroy(&coarse_mutex);
+  }
+
+  bool add(const T& item)
+  {
+    return insert_item(item);
+  }
+
+  bool add(T&& item)
+  {
+    return insert_item(std::move(item));
+  }
+
+  bool remove(const T& item)
+  {
+    Remove operation = { &item, false };
+    run(operation);
+    return operation.removed;
+  }
+
+  bool contains(const T& item)
+  {
+    Contains operation = { &item, false };
+    run(operation);
+    return operation.found;
+  }
+
+  //Batches take the coarse mutex once or go to the batch operations of the fine set
+  size_t add_all(const T* begin, const T* end)
+  {
+    AddAll operation = { begin, end, 0 };
+    run(operation);
+    return operation.added;
+  }
+
+  size_t remove_all(const T* begin, const T* end)
+  {
+    RemoveAll operation = { begin, end, 0 };
+    run(operation);
+    return operation.removed;
+  }
+
+  void contains_all(const T* begin, const T* end, bool* out)
+  {
+    ContainsAll operation = { begin, end, out };
+    run(operation);
+  }
+
+  //Current mode
+  Mode current_mode() const
+  {
+    return (Mode)mode.load(std::memory_order_acquire);
+  }
+
+  //Mode switches since creation
+  size_t mode_switches() const
+  {
+    return switches.load(std::memory_order_relaxed);
+  }
+
+  //Move all elements to the target mode while operations are stopped (nothing if another migration is running)
+  void migrate(Mode target)
+  {
+    bool expected = false;
+    if (!migrating.compare_exchange_strong(expected, true, std::memory_order_acquire))
+      return;
+    switch_mode(target);
+    migrating.store(false, std::memory_order_release);
+  }
+
+protected:
+  //Copy elements with keys in [lo_key, hi_key] as of one point in time (the mode does not change meanwhile)
+  void collect(size_t lo_key, size_t hi_key, std::vector<T>& out)
+  {
+    Collect operation = { lo_key, hi_key, &out };
+    run(operation);
+  }
+
+public:
+  //Statistics of the coarse mode and of the current fine set (counted whatever SET_STATS is, they drive the mode)
+  SetStatistics statistics() const
+  {
+    SetStatistics statistics = stats.get();
+    EpochDomain::Guard guard(operations);
+    Fine* current = fine.load(std::memory_order_acquire);
+    if (current)
+      statistics.add(current->statistics());
+    return statistics;
+  }
+
+  void reset_statistics()
+  {
+    stats.reset();
+    EpochDomain::Guard guard(operations);
+    Fine* current = fine.load(std::memory_order_acquire);
+    if (current)
+      current->reset_statistics();
+  }
+
+  static void set_error_handler(void(*handler)(const char*))
+  {
+    error_handler = handler;
+    Fine::set_error_handler(handler);
+  }
+
+private:
+  //Element of the coarse mode tree or a search key for it
+  //The element is constructed in element entries only, bounds and search keys do not need a T.
+  struct Entry
+  {
+    enum Kind { KIND_BOUND, KIND_PROBE, KIND_ITEM };
+
+    //Range bound: comes before every element with the key
+    explicit Entry(size_t init_key) : key(init_key), kind(KIND_BOUND), probe(nullptr) {}
+
+    //Search key that refers to an element outside of the tree (nothing is copied for a lookup)
+    Entry(size_t init_key, const T* init_probe) : key(init_key), kind(KIND_PROBE), probe(init_probe) {}
+
+    //Element copied or moved into the tree
+    template <class U>
+    Entry(size_t init_key, U&& init_item) : key(init_key), kind(KIND_ITEM), probe(nullptr)
+    {
+      new (&storage) T(std::forward<U>(init_item));
+    }
+
+    ~Entry()
+    {
+      if (kind == KIND_ITEM)
+        item().~T();
+    }
+
+    size_t key; //Data key (hash)
+    Kind kind; //Bound, search key or element
+    const T* probe; //Searched element
+
+    //Raw data (element entries only)
+    const T& item() const
+    {
+      return *reinterpret_cast<const T*>(&storage);
+    }
+
+    const T& value() const
+    {
+      return kind == KIND_PROBE ? *probe : item();
+    }
+
+  private:
+    Entry(const Entry&);
+    Entry& operator=(const Entry&);
+
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type storage; //Element (constructed in element entries only)
+  };
+
+  //Order of the tree: by key, elements with colliding keys by the comparator (the order of the fine set)
+  struct EntryOrder
+  {
+    bool operator()(const Entry& left, const Entry& right) const
+    {
+      if (left.key != right.key)
+        return left.key < right.key;
+      if (left.kind == Entry::KIND_BOUND || right.kind == Entry::KIND_BOUND)
+        return left.kind == Entry::KIND_BOUND && right.kind != Entry::KIND_BOUND;
+      return Compare()(left.value(), right.value());
+    }
+  };
+
+  typedef std::set<Entry, EntryOrder> Tree;
+
+  //Operations: in_coarse() runs under the coarse mutex, in_fine() on the fine set
+  struct Contains
+  {
+    const T* item; //Searched element
+    bool found; //Result
+
+    void in_coarse(SetAdaptive& set)
+    {
+      found = set.coarse.find(Entry(set.generate_hash(*item), item)) != set.coarse.end();
+    }
+
+    void in_fine(Fine& set)
+    {
+      found = set.contains(*item);
+    }
+  };
+
+  template <class U>
+  struct Insert
+  {
+    typename std::remove_reference<U>::type* item; //Element copied or moved into the set
+    bool added; //Result
+
+    void in_coarse(SetAdaptive& set)
+    {
+      added = set.insert_coarse(std::forward<U>(*item));
+    }
+
+    void in_fine(Fine& set)
+    {
+      added = set.add(std::forward<U>(*item));
+    }
+  };
+
+  struct Remove
+  {
+    const T* item; //Removed element
+    bool removed; //Result
+
+    void in_coarse(SetAdaptive& set)
+    {
+      removed = set.coarse.erase(Entry(set.generate_hash(*item), item)) != 0;
+    }
+
+    void in_fine(Fine& set)
+    {
+      removed = set.remove(*item);
+    }
+  };
+
+  struct AddAll
+  {
+    const T *begin, *end; //Added range
+    size_t added; //Result
+
+    void in_coarse(SetAdaptive& set)
+    {
+      for (const T* item = begin; item != end; ++item)
+        if (set.insert_coarse(*item))
+          ++added;
+    }
+
+    void in_fine(Fine& set)
+    {
+      added = set.add_all(begin, end);
+    }
+  };
+
+  struct RemoveAll
+  {
+    const T *begin, *end; //Removed range
+    size_t removed; //Result
+
+    void in_coarse(SetAdaptive& set)
+    {
+      for (const T* item = begin; item != end; ++item)
+        removed += set.coarse.erase(Entry(set.generate_hash(*item), item));
+    }
+
+    void in_fine(Fine& set)
+    {
+      removed = set.remove_all(begin, end);
+    }
+  };
+
+  struct ContainsAll
+  {
+    const T *begin, *end; //Searched range
+    bool* out; //Results
+
+    void in_coarse(SetAdaptive& set)
+    {
+      for (const T* item = begin; item != end; ++item)
+        out[item - begin] = set.coarse.find(Entry(set.generate_hash(*item), item)) != set.coarse.end();
+    }
+
+    void in_fine(Fine& set)
+    {
+      set.contains_all(begin, end, out);
+    }
+  };
+
+  struct Collect
+  {
+    size_t lo_key, hi_key; //Keys range
+    std::vector<T>* out; //Collected elements
+
+    void in_coarse(SetAdaptive& set)
+    {
+      out->clear();
+      for (typename Tree::const_iterator entry = set.coarse.lower_bound(Entry(lo_key)); entry != set.coarse.end() && entry->key <= hi_key; ++entry)
+        out->push_back(entry->item());
+    }
+
+    void in_fine(Fine& set)
+    {
+      Set<T>::collect_from(set, lo_key, hi_key, *out);
+    }
+  };
+
+  std::atomic<int> mode; //Current mode
+  Tree coarse; //Elements in the coarse mode
+  pthread_mutex_t coarse_mutex; //Lock of the coarse mode
+  std::atomic<Fine*> fine; //Elements in the fine mode (nullptr in the coarse mode)
+  mutable EpochDomain operations; //Mode domain: operations run in its critical sections, a migration waits for them
+  std::atomic<bool> blocked; //Whether a migration keeps new operations out
+  std::atomic<bool> migrating; //Whether a migration or a decision is running (its thread owns window_start)
+  SetStatistics window_start; //Statistics of the current mode at the last decision
+  uint64_t fine_window; //Searches a decision in the fine mode needs (changed with migrating held)
+  size_t coarse_decisions; //Decisions to stay in the coarse mode since the set came back to it
+  std::atomic<size_t> switches; //Mode switches
+  Stats stats; //Contention statistics of the coarse mode (see set_stats.hpp)
+  static void(*error_handler)(const char*); //Fatal errors handler
+
+  //Add an element to the tree unless it is there (it is moved only if it is added)
+  template <class U>
+  bool insert_coarse(U&& item)
+  {
+    Entry key(generate_hash(item), static_cast<const T*>(&item));
+    typename Tree::iterator position = coarse.lower_bound(key);
+    if (position != coarse.end() && !EntryOrder()(key, *position))
+      return false;
+    coarse.emplace_hint(position, key.key, std::forward<U>(item));
+    return true;
+  }
+
+  //Whether the current operation of the thread looks at the statistics
+  static bool sampled()
+  {
+    static thread_local size_t count = 0;
+    return ++count % DECISION_PERIOD == 0;
+  }
+
+  //Run an operation in the current mode
+  //An operation never waits inside the mode domain, so a migration does not wait for it for long.
+  template <class Operation>
+  void run(Operation& operation)
+  {
+    bool decide = sampled();
+    while (true)
+    {
+      {
+        EpochDomain::Guard guard(operations);
+        //Entering the domain has fenced the announcement before this check: a migration that blocks
+        //operations later waits for this one
+        if (!blocked.load(std::memory_order_acquire))
+        {
+          if (mode.load(std::memory_order_relaxed) == MODE_COARSE)
+          {
+            lock_coarse();
+            operation.in_coarse(*this);
+            unlock_coarse();
+          }
+          else
+            operation.in_fine(*fine.load(std::memory_order_relaxed));
+          break;
+        }
+      }
+      while (blocked.load(std::memory_order_acquire))
+        sched_yield();
+    }
+    if (decide)
+      adapt();
+  }
+
+  //Take the coarse mutex, an acquisition that finds it held counts as a retry and only such one is timed
+  void lock_coarse()
+  {
+    if (pthread_mutex_trylock(&coarse_mutex) == 0)
+    {
+      stats.add(Stats::LOCK_ACQUISITIONS);
+      return;
+    }
+    stats.add(Stats::RETRIES);
+    Stats::LockTiming timing(stats);
+    if (pthread_mutex_lock(&coarse_mutex) != 0)
+      error_handler(g_msg_err_mutex_lock);
+  }
+
+  void unlock_coarse()
+  {
+    if (pthread_mutex_unlock(&coarse_mutex) != 0)
+      error_handler(g_msg_err_mutex_unlock);
+  }
+
+  //Statistics of the current mode (called with migrating held, so the mode does not change)
+  SetStatistics mode_statistics()
+  {
+    if (mode.load(std::memory_order_relaxed) == MODE_COARSE)
+      return stats.get();
+    return fine.load(std::memory_order_relaxed)->statistics();
+  }
+
+  //Decide on the statistics since the last decision (called outside of the mode domain)
+  void adapt()
+  {
+    bool expected = false;
+    if (!migrating.compare_exchange_strong(expected, true, std::memory_order_acquire))
+      return;
+    SetStatistics now = mode_statistics();
+    //Counters that went back were reset, the window starts again
+    if (now.retries < window_start.retries || now.lock_acquisitions < window_start.lock_acquisitions ||
+      now.lock_wait_ns < window_start.lock_wait_ns || now.traversals < window_start.traversals)
+      window_start = now;
+    uint64_t acquisitions = now.lock_acquisitions - window_start.lock_acquisitions;
+    uint64_t wait_ns = now.lock_wait_ns - window_start.lock_wait_ns;
+    uint64_t searches = now.traversals - window_start.traversals;
+    uint64_t retries = now.retries - window_start.retries;
+    if (mode.load(std::memory_order_relaxed) == MODE_COARSE)
+    {
+      if (acquisitions >= WINDOW_OPERATIONS)
+      {
+        window_start = now;
+        if (retries * 100 >= acquisitions * TO_FINE_CONTENDED_PERCENT)
+        {
+          if (coarse_decisions < BOUNCE_DECISIONS && fine_window < MAX_WINDOW_OPERATIONS)
+            fine_window *= 2;
+          switch_mode(MODE_FINE);
+        }
+        else if (++coarse_decisions > BOUNCE_DECISIONS && fine_window > WINDOW_OPERATIONS)
+          fine_window /= 2;
+      }
+    }
+    else if (searches >= fine_window)
+    {
+      window_start = now;
+      if (retries * 100 <= searches * TO_COARSE_RETRY_PERCENT && wait_ns <= acquisitions * TO_COARSE_WAIT_NS)
+      {
+        coarse_decisions = 0;
+        switch_mode(MODE_COARSE);
+      }
+    }
+    migrating.store(false, std::memory_order_release);
+  }
+
+  //Move every element to the target mode (called with migrating held and outside of the mode domain)
+  void switch_mode(Mode target)
+  {
+    if (mode.load(std::memory_order_relaxed) == target)
+      return;
+    //Keep new operations out and wait for the ones that may have missed it
+    blocked.store(true);
+    operations.synchronize();
+    std::vector<T> items;
+    Fine* replaced = nullptr;
+    if (target == MODE_FINE)
+    {
+      items.reserve(coarse.size());
+      for (typename Tree::const_iterator entry = coarse.begin(); entry != coarse.end(); ++entry)
+        items.push_back(entry->item());
+      //The range constructor links the elements without node locks
+      Fine* created = new Fine(items.data(), items.data() + items.size());
+      if (!created)
+        error_handler(g_msg_err_node_create);
+      coarse.clear();
+      fine.store(created, std::memory_order_release);
+    }
+    else
+    {
+      replaced = fine.load(std::memory_order_relaxed);
+      Set<T>::collect_from(*replaced, 0, SIZE_MAX, items);
+      //The elements come in the tree order, so every one is inserted at the end
+      for (size_t i = 0; i < items.size(); ++i)
+        coarse.emplace_hint(coarse.end(), generate_hash(items[i]), std::move(items[i]));
+      fine.store(nullptr, std::memory_order_release);
+    }
+    mode.store(target, std::memory_order_relaxed);
+    window_start = mode_statistics();
+    switches.fetch_add(1, std::memory_order_relaxed);
+    blocked.store(false, std::memory_order_release);
+    //Statistics queries do not keep migrations out, the replaced fine set is freed after they have finished
+    if (replaced)
+    {
+      operations.synchronize();
+      delete replaced;
+    }
+  }
+
+  //Add an element copied or moved into the current mode
+  template <class U>
+  bool insert_item(U&& item)
+  {
+    Insert<U> operation = { &item, false };
+    run(operation);
+    return operation.added;
+  }
+
+  size_t generate_hash(const T& item)
+  {
+    return std::hash<T>()(item);
+  }
+};
+
+template <class T, class Lock, class Compare>
+void(*SetAdaptive<T, Lock, Compare>::error_handler)(const char*) = nullptr;
+
+#endif
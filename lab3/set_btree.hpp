@@ -0,0 +1,490 @@
+
+#ifndef SET_BTREE_QJWMRC__
+#define SET_BTREE_QJWMRC__
+
+#include <functional>
+#include <atomic>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <bits/stdc++.h>
+
+#include "set.h"
+#include "snapshot.hpp"
+#include "locks.hpp"
+#include "key_search.hpp"
+
+//B+-tree set with optimistic lock coupling (Capacity is keys per node)
+//Every node has a version latch. Readers descend without writing shared memory: they remember the
+//versions of the node and its parent and validate them after reading, restarting if a writer has
+//been there. Writers latch only the leaf they change, full nodes are split on the way down so a
+//split never has to go up the tree. Removal does not merge nodes, so nodes live until the set is destroyed.
+template <class T, size_t Capacity = 16>
+class SetBTree final : public SetBase<T, SetBTree<T, Capacity> >
+{
+public:
+  static_assert(Capacity >= 4 && Capacity % 4 == 0, "Capacity must be a multiple of 4 not less than 4");
+
+  SetBTree()
+  {
+    if (!error_handler) //Error handler needs to be specified before
+      error_handler(g_msg_err_error_handler);
+    Leaf* leaf = new Leaf();
+    if (!leaf)
+      error_handler(g_msg_err_node_create);
+    root.store(leaf);
+  }
+
+  ~SetBTree()
+  {
+    destroy(root.load());
+  }
+
+  bool add(const T& item)
+  {
+    return insert_item(item);
+  }
+
+  bool add(T&& item)
+  {
+    return insert_item(std::move(item));
+  }
+
+  bool remove(const T& item)
+  {
+    SnapshotGate::WriteScope write(gate);
+    size_t key = generate_hash(item);
+    bool removed = false;
+    for (SpinWait spin; !retry(try_remove(key, removed), spin););
+    return removed;
+  }
+
+  bool contains(const T& item)
+  {
+    size_t key = generate_hash(item);
+    bool found = false;
+    for (SpinWait spin; !retry(try_contains(key, found), spin););
+    return found;
+  }
+
+protected:
+  //Copy elements with keys in [lo_key, hi_key] as of one point in time (see snapshot.hpp)
+  void collect(size_t lo_key, size_t hi_key, std::vector<T>& out)
+  {
+    Collector collector = { &root, lo_key, hi_key, &out };
+    gate.read(collector);
+  }
+
+public:
+  SetStatistics statistics() const
+  {
+    return stats.get();
+  }
+
+  void reset_statistics()
+  {
+    stats.reset();
+  }
+
+  static void set_error_handler(void(*handler)(const char*))
+  {
+    error_handler = handler;
+  }
+
+private:
+  enum Attempt { ATTEMPT_DONE, ATTEMPT_CONFLICT, ATTEMPT_SPLIT };
+
+  //Version latch: odd versions are latched, every write unlatch moves to the next version
+  class VersionLatch
+  {
+  public:
+    VersionLatch() : version(0) {}
+
+    //Remember the version of an unlatched node (false if a writer holds it)
+    bool read_lock(uint64_t& current) const
+    {
+      current = version.load(std::memory_order_acquire);
+      return !(current & 1);
+    }
+
+    //Whether nothing has been written since the version was remembered
+    bool validate(uint64_t remembered) const
+    {
+      std::atomic_thread_fence(std::memory_order_acquire);
+      return version.load(std::memory_order_relaxed) == remembered;
+    }
+
+    //Latch the node for writing if it is still of the remembered version
+    bool upgrade(uint64_t remembered)
+    {
+      return version.compare_exchange_strong(remembered, remembered + 1, std::memory_order_acquire);
+    }
+
+    //Latch the node for writing whatever its version (waits for the current writer)
+    void lock()
+    {
+      uint64_t current = 0;
+      for (SpinWait spin; !read_lock(current) || !upgrade(current); spin.wait());
+    }
+
+    void unlock()
+    {
+      version.fetch_add(1, std::memory_order_release);
+    }
+
+  private:
+    std::atomic<uint64_t> version; //Node version
+  };
+
+  //Common part of inner nodes and leaves
+  struct Node
+  {
+    Node(bool i_leaf) : leaf(i_leaf), count(0)
+    {
+      std::fill(keys, keys + Capacity, SIZE_MAX);
+    }
+
+    VersionLatch latch; //Node latch
+    bool leaf; //Whether the node is a leaf
+    size_t count; //Number of keys
+    size_t keys[Capacity]; //Sorted keys (hashes), unused ones are SIZE_MAX
+  };
+
+  //Inner node: child i holds keys in (keys[i - 1], keys[i]]
+  struct Inner : Node
+  {
+    Inner() : Node(false)
+    {
+      std::fill(children, children + Capacity + 1, (Node*)nullptr);
+    }
+
+    Node* children[Capacity + 1]; //Subtrees (entries past count stay valid after a split)
+  };
+
+  //Leaf: elements in the keys order
+  struct Leaf : Node
+  {
+    Leaf() : Node(true), next(nullptr) {}
+
+    T items[Capacity]; //Raw data
+    Leaf* next; //Next leaf in the keys order
+  };
+
+  std::atomic<Node*> root; //Root of the tree
+  SnapshotGate gate; //Consistent snapshots against concurrent modifications
+  SetStats stats; //Contention statistics (see set_stats.hpp)
+  static void(*error_handler)(const char*); //Fatal errors handler
+
+  //Walk over the leaves for the snapshot gate (nodes are never freed while the set lives)
+  //The inner nodes are read optimistically and validated as in a descent, a conflict makes the gate retry.
+  //Writers shift elements inside a leaf, so every leaf is copied latched.
+  struct Collector
+  {
+    std::atomic<Node*>* root; //Root of the tree
+    size_t lo_key, hi_key; //Keys range
+    std::vector<T>* out; //Collected elements
+
+    bool operator()()
+    {
+      out->clear();
+      Node* node = root->load(std::memory_order_acquire);
+      uint64_t version = 0;
+      if (!node->latch.read_lock(version) || node != root->load(std::memory_order_acquire))
+        return false;
+      while (!node->leaf)
+      {
+        Inner* inner = static_cast<Inner*>(node);
+        node = child(inner, lo_key);
+        //The child pointer is only valid if the node has not changed while it was read
+        if (!inner->latch.validate(version) || !node->latch.read_lock(version))
+          return false;
+      }
+      for (Leaf* leaf = static_cast<Leaf*>(node); leaf != nullptr; )
+      {
+        leaf->latch.lock();
+        bool past = false;
+        for (size_t i = 0; i < leaf->count && !past; ++i)
+        {
+          past = leaf->keys[i] > hi_key;
+          if (!past && leaf->keys[i] >= lo_key)
+            out->push_back(leaf->items[i]);
+        }
+        Leaf* next = leaf->next;
+        leaf->latch.unlock();
+        if (past)
+          break;
+        leaf = next;
+      }
+      return true;
+    }
+  };
+
+  //Leaf for the key with the versions the descent has seen
+  struct Path
+  {
+    Leaf* leaf; //Leaf for the key
+    uint64_t leaf_version;
+    Inner* parent; //Parent of the leaf (nullptr if the leaf is the root)
+    uint64_t parent_version;
+  };
+
+  //Count a failed attempt and back off (false while the operation has to be attempted again)
+  bool retry(int attempt, SpinWait& spin)
+  {
+    if (attempt == ATTEMPT_DONE)
+      return true;
+    //A split restarts the descent right away, a conflict waits for the writer
+    if (attempt == ATTEMPT_CONFLICT)
+    {
+      stats.add(SetStats::RETRIES);
+      spin.wait();
+    }
+    return false;
+  }
+
+  //The element is moved into the leaf only in the attempt that adds it
+  template <class U>
+  int try_add(size_t key, U&& item, bool& added)
+  {
+    Path path;
+    int attempt = descend(key, true, path);
+    if (attempt != ATTEMPT_DONE)
+      return attempt;
+    if (!lock_leaf(path))
+      return ATTEMPT_CONFLICT;
+
+    Leaf* leaf = path.leaf;
+    size_t position = KeySearch::lower_bound(leaf->keys, leaf->count, key);
+    added = position == leaf->count || leaf->keys[position] != key;
+    if (added)
+    {
+      memmove(leaf->keys + position + 1, leaf->keys + position, (leaf->count - position) * sizeof(size_t));
+      std::copy_backward(leaf->items + position, leaf->items + leaf->count, leaf->items + leaf->count + 1);
+      leaf->keys[position] = key;
+      leaf->items[position] = std::forward<U>(item);
+      ++leaf->count;
+    }
+    leaf->latch.unlock();
+    return ATTEMPT_DONE;
+  }
+
+  int try_remove(size_t key, bool& removed)
+  {
+    Path path;
+    int attempt = descend(key, false, path);
+    if (attempt != ATTEMPT_DONE)
+      return attempt;
+    if (!lock_leaf(path))
+      return ATTEMPT_CONFLICT;
+
+    Leaf* leaf = path.leaf;
+    size_t position = KeySearch::lower_bound(leaf->keys, leaf->count, key);
+    removed = position < leaf->count && leaf->keys[position] == key;
+    if (removed)
+    {
+      memmove(leaf->keys + position, leaf->keys + position + 1, (leaf->count - position - 1) * sizeof(size_t));
+      std::copy(leaf->items + position + 1, leaf->items + leaf->count, leaf->items + position);
+      leaf->keys[--leaf->count] = SIZE_MAX;
+    }
+    leaf->latch.unlock();
+    return ATTEMPT_DONE;
+  }
+
+  int try_contains(size_t key, bool& found)
+  {
+    Path path;
+    int attempt = descend(key, false, path);
+    if (attempt != ATTEMPT_DONE)
+      return attempt;
+
+    Leaf* leaf = path.leaf;
+    size_t count = leaf->count;
+    size_t position = KeySearch::lower_bound(leaf->keys, count, key);
+    found = position < count && leaf->keys[position] == key;
+    //The parent check catches a split that has moved the key to a new leaf before the leaf was reached
+    if (!leaf->latch.validate(path.leaf_version) || (path.parent && !path.parent->latch.validate(path.parent_version)))
+      return ATTEMPT_CONFLICT;
+    return ATTEMPT_DONE;
+  }
+
+  //Latch the leaf of the path for writing if neither it nor its parent has changed since the descent
+  bool lock_leaf(const Path& path)
+  {
+    if (!path.leaf->latch.upgrade(path.leaf_version))
+      return false;
+    if (path.parent && !path.parent->latch.validate(path.parent_version))
+    {
+      path.leaf->latch.unlock();
+      return false;
+    }
+    stats.add(SetStats::LOCK_ACQUISITIONS);
+    return true;
+  }
+
+  //Child of an inner node that may hold the key
+  //The count is read once and bounds the index, so a torn read of a node being changed still gives a node.
+  static Node* child(Inner* inner, size_t key)
+  {
+    size_t count = inner->count;
+    return inner->children[std::min(KeySearch::lower_bound(inner->keys, count, key), count)];
+  }
+
+  //Optimistic descent to the leaf for the key (splits a full node on the way and restarts if split is set)
+  int descend(size_t key, bool split, Path& path)
+  {
+    Node* node = root.load(std::memory_order_acquire);
+    uint64_t version = 0;
+    if (!node->latch.read_lock(version) || node != root.load(std::memory_order_acquire))
+      return ATTEMPT_CONFLICT;
+
+    Inner* parent = nullptr;
+    uint64_t parent_version = 0;
+    size_t steps = 0;
+    while (!node->leaf)
+    {
+      Inner* inner = static_cast<Inner*>(node);
+      if (split && inner->count == Capacity)
+        return split_node(inner, version, parent, parent_version);
+      if (parent && !parent->latch.validate(parent_version))
+        return ATTEMPT_CONFLICT;
+      parent = inner;
+      parent_version = version;
+      node = child(inner, key);
+      //The child pointer is only valid if the node has not changed while it was read
+      if (!inner->latch.validate(version) || !node->latch.read_lock(version))
+        return ATTEMPT_CONFLICT;
+      ++steps;
+    }
+    if (split && node->count == Capacity)
+      return split_node(node, version, parent, parent_version);
+
+    stats.traversal(steps);
+    path.leaf = static_cast<Leaf*>(node);
+    path.leaf_version = version;
+    path.parent = parent;
+    path.parent_version = parent_version;
+    return ATTEMPT_DONE;
+  }
+
+  //Split a full node latching it and its parent (the descent has split the parent before if it was full)
+  int split_node(Node* node, uint64_t version, Inner* parent, uint64_t parent_version)
+  {
+    if (parent && !parent->latch.upgrade(parent_version))
+      return ATTEMPT_CONFLICT;
+    if (!node->latch.upgrade(version))
+    {
+      if (parent)
+        parent->latch.unlock();
+      return ATTEMPT_CONFLICT;
+    }
+    //Someone has split the root and the node has got a parent
+    if (!parent && node != root.load(std::memory_order_relaxed))
+    {
+      node->latch.unlock();
+      return ATTEMPT_CONFLICT;
+    }
+    stats.add(SetStats::LOCK_ACQUISITIONS, parent ? 2 : 1);
+
+    size_t separator = 0;
+    Node* right = node->leaf ? split_leaf(static_cast<Leaf*>(node), separator) : split_inner(static_cast<Inner*>(node), separator);
+    if (parent)
+      insert_child(parent, separator, right);
+    else
+    {
+      Inner* top = new Inner();
+      if (!top)
+        error_handler(g_msg_err_node_create);
+      stats.add(SetStats::ALLOCATIONS);
+      top->keys[0] = separator;
+      top->children[0] = node;
+      top->children[1] = right;
+      top->count = 1;
+      root.store(top, std::memory_order_release);
+    }
+    node->latch.unlock();
+    if (parent)
+      parent->latch.unlock();
+    return ATTEMPT_SPLIT;
+  }
+
+  //Move the upper half of a full latched leaf to a new leaf (separator is the largest key left)
+  Node* split_leaf(Leaf* leaf, size_t& separator)
+  {
+    const size_t half = Capacity / 2;
+    Leaf* right = new Leaf();
+    if (!right)
+      error_handler(g_msg_err_node_create);
+    stats.add(SetStats::ALLOCATIONS);
+    memcpy(right->keys, leaf->keys + half, (Capacity - half) * sizeof(size_t));
+    std::copy(leaf->items + half, leaf->items + Capacity, right->items);
+    right->count = Capacity - half;
+    right->next = leaf->next;
+    std::fill(leaf->keys + half, leaf->keys + Capacity, SIZE_MAX);
+    leaf->count = half;
+    leaf->next = right;
+    separator = leaf->keys[half - 1];
+    return right;
+  }
+
+  //Move the upper half of a full latched inner node to a new node (the middle key goes up as the separator)
+  Node* split_inner(Inner* inner, size_t& separator)
+  {
+    const size_t half = Capacity / 2;
+    Inner* right = new Inner();
+    if (!right)
+      error_handler(g_msg_err_node_create);
+    stats.add(SetStats::ALLOCATIONS);
+    separator = inner->keys[half];
+    memcpy(right->keys, inner->keys + half + 1, (Capacity - half - 1) * sizeof(size_t));
+    std::copy(inner->children + half + 1, inner->children + Capacity + 1, right->children);
+    right->count = Capacity - half - 1;
+    std::fill(inner->keys + half, inner->keys + Capacity, SIZE_MAX);
+    inner->count = half;
+    return right;
+  }
+
+  //Insert a separator and the child right of it into a latched inner node that is not full
+  static void insert_child(Inner* inner, size_t separator, Node* right)
+  {
+    size_t position = KeySearch::lower_bound(inner->keys, inner->count, separator);
+    memmove(inner->keys + position + 1, inner->keys + position, (inner->count - position) * sizeof(size_t));
+    memmove(inner->children + position + 2, inner->children + position + 1, (inner->count - position) * sizeof(Node*));
+    inner->keys[position] = separator;
+    inner->children[position + 1] = right;
+    ++inner->count;
+  }
+
+  static void destroy(Node* node)
+  {
+    if (!node->leaf)
+    {
+      Inner* inner = static_cast<Inner*>(node);
+      for (size_t i = 0; i <= inner->count; ++i)
+        destroy(inner->children[i]);
+      delete inner;
+    }
+    else
+      delete static_cast<Leaf*>(node);
+  }
+
+  //Add an element copied or moved into the new node
+  template <class U>
+  bool insert_item(U&& item)
+  {
+    SnapshotGate::WriteScope write(gate);
+    size_t key = generate_hash(item);
+    bool added = false;
+    for (SpinWait spin; !retry(try_add(key, std::forward<U>(item), added), spin););
+    return added;
+  }
+
+  size_t generate_hash(const T& item)
+  {
+    return std::hash<T>()(item);
+  }
+};
+
+template <class T, size_t Capacity>
+void(*SetBTree<T, Capacity>::error_handler)(const char*) = nullptr;
+
+#endif
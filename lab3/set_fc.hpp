@@ -0,0 +1,363 @@
+
+#ifndef SET_FC_TVRKQY__
+#define SET_FC_TVRKQY__
+
+#include <functional>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <sched.h>
+#include <bits/stdc++.h>
+
+#include "set.h"
+#include "locks.hpp"
+
+//Flat-combining set over a sorted array
+//Threads publish requests in their slots and wait. The thread that takes the combiner lock collects
+//every published request, sorts them by key and applies them to the array in one merge pass that
+//copies the untouched runs of the array in bulk, so the array stays in the combiner's cache.
+template <class T>
+class SetFlatCombining final : public SetBase<T, SetFlatCombining<T> >
+{
+public:
+  static const size_t MAX_SLOTS = 128; //Maximum number of threads inside the set at the same time
+  static const size_t CACHE_LINE = 64; //Padding between slots
+
+  SetFlatCombining() : combiner(false), slots_used(0)
+  {
+    if (!error_handler) //Error handler needs to be specified before
+      error_handler(g_msg_err_error_handler);
+  }
+
+  bool add(const T& item)
+  {
+    bool result = false;
+    execute(OP_ADD, &item, &item + 1, &result);
+    return result;
+  }
+
+  bool add(T&& item)
+  {
+    bool result = false;
+    execute(OP_ADD, &item, &item + 1, &result, true);
+    return result;
+  }
+
+  bool remove(const T& item)
+  {
+    bool result = false;
+    execute(OP_REMOVE, &item, &item + 1, &result);
+    return result;
+  }
+
+  bool contains(const T& item)
+  {
+    bool result = false;
+    execute(OP_CONTAINS, &item, &item + 1, &result);
+    return result;
+  }
+
+  //The whole range is published as one request and applied in one combining pass
+  size_t add_all(const T* begin, const T* end)
+  {
+    bool* results = new bool[end - begin];
+    size_t added = execute(OP_ADD, begin, end, results);
+    delete[] results;
+    return added;
+  }
+
+  size_t remove_all(const T* begin, const T* end)
+  {
+    bool* results = new bool[end - begin];
+    size_t removed = execute(OP_REMOVE, begin, end, results);
+    delete[] results;
+    return removed;
+  }
+
+  void contains_all(const T* begin, const T* end, bool* out)
+  {
+    execute(OP_CONTAINS, begin, end, out);
+  }
+
+protected:
+  //Copy elements with keys in [lo_key, hi_key]: the copy is published as a request, so it is served by
+  //the next combining pass like any modification instead of competing with the writers for the lock
+  void collect(size_t lo_key, size_t hi_key, std::vector<T>& out)
+  {
+    Slot* slot = acquire_slot();
+    slot->operation = OP_COLLECT;
+    slot->begin = slot->end = nullptr;
+    slot->lo_key = lo_key;
+    slot->hi_key = hi_key;
+    slot->out = &out;
+    wait(slot);
+  }
+
+public:
+  SetStatistics statistics() const
+  {
+    return stats.get();
+  }
+
+  void reset_statistics()
+  {
+    stats.reset();
+  }
+
+  static void set_error_handler(void(*handler)(const char*))
+  {
+    error_handler = handler;
+  }
+
+private:
+  enum Operation { OP_ADD, OP_REMOVE, OP_CONTAINS, OP_COLLECT };
+  enum SlotState { SLOT_IDLE, SLOT_PENDING, SLOT_DONE };
+
+  //Element of the array
+  struct Entry
+  {
+    size_t key; //Data key (hash)
+    T item; //Raw data
+  };
+
+  //Published request of a thread
+  struct Slot
+  {
+    Slot() : owned(false), state(SLOT_IDLE), operation(OP_CONTAINS), movable(false), begin(nullptr), end(nullptr), results(nullptr),
+      succeeded(0), lo_key(0), hi_key(0), out(nullptr) {}
+
+    std::atomic<bool> owned; //Whether the slot is owned by a thread
+    std::atomic<int> state; //Request state
+    int operation; //Requested operation
+    bool movable; //Whether added elements may be moved from
+    const T* begin; //Request elements
+    const T* end;
+    bool* results; //Result for every element
+    size_t succeeded; //Elements the operation succeeded for
+    size_t lo_key, hi_key; //Keys range of a collect request
+    std::vector<T>* out; //Output of a collect request
+    char padding[CACHE_LINE]; //Keep slots of different threads in different cache lines
+  };
+
+  //Request element in the combining pass
+  struct Request
+  {
+    size_t key; //Element key
+    size_t slot; //Slot of the request
+    size_t index; //Element index in the request
+
+    bool operator<(const Request& other) const
+    {
+      //Requests for one key are applied in slot order, every order is valid for concurrent requests
+      if (key != other.key)
+        return key < other.key;
+      if (slot != other.slot)
+        return slot < other.slot;
+      return index < other.index;
+    }
+  };
+
+  std::vector<Entry> entries; //Elements sorted by key
+  std::vector<Entry> merged; //Array the combiner builds the next version in
+  std::vector<Request> requests; //Requests of the current combining pass
+  std::vector<size_t> combined; //Slots of the current combining pass
+  std::atomic<bool> combiner; //Combiner lock
+  Slot slots[MAX_SLOTS]; //Slots of the threads
+  std::atomic<size_t> slots_used; //Slots high-water mark
+  SetStats stats; //Contention statistics (see set_stats.hpp)
+  static void(*error_handler)(const char*); //Fatal errors handler
+
+  static bool compare_entry_key(const Entry& entry, size_t key)
+  {
+    return entry.key < key;
+  }
+
+  //Request an operation on the elements and wait until it is applied (number of elements it succeeded for)
+  //Elements of a movable request are moved into the array by the combiner, so they have to be modifiable.
+  size_t execute(int operation, const T* begin, const T* end, bool* results, bool movable = false)
+  {
+    if (begin == end)
+      return 0;
+    Slot* slot = acquire_slot();
+    slot->operation = operation;
+    slot->movable = movable;
+    slot->begin = begin;
+    slot->end = end;
+    slot->results = results;
+    return wait(slot);
+  }
+
+  //Publish a filled slot and wait until a combiner (possibly this thread) applies it (see execute(...))
+  size_t wait(Slot* slot)
+  {
+    slot->state.store(SLOT_PENDING, std::memory_order_release);
+    SpinWait spin;
+    while (slot->state.load(std::memory_order_acquire) != SLOT_DONE)
+    {
+      if (!combiner.load(std::memory_order_relaxed) && !combiner.exchange(true, std::memory_order_acquire))
+      {
+        stats.add(SetStats::LOCK_ACQUISITIONS);
+        combine();
+        combiner.store(false, std::memory_order_release);
+      }
+      else
+        spin.wait();
+    }
+    size_t succeeded = slot->succeeded;
+    slot->state.store(SLOT_IDLE, std::memory_order_relaxed);
+    slot->owned.store(false, std::memory_order_release);
+    return succeeded;
+  }
+
+  //Take a free slot (start from a per-thread hint to keep using the same slot)
+  Slot* acquire_slot()
+  {
+    static thread_local size_t hint = std::hash<std::thread::id>()(std::this_thread::get_id()) % MAX_SLOTS;
+    while (true)
+    {
+      for (size_t i = 0; i < MAX_SLOTS; ++i)
+      {
+        size_t index = (hint + i) % MAX_SLOTS;
+        bool expected = false;
+        if (!slots[index].owned.load(std::memory_order_relaxed) &&
+          slots[index].owned.compare_exchange_strong(expected, true, std::memory_order_acquire))
+        {
+          hint = index;
+          //The high-water mark has to cover the slot before the request is published
+          size_t used = slots_used.load();
+          while (used < index + 1 && !slots_used.compare_exchange_weak(used, index + 1));
+          return &slots[index];
+        }
+      }
+      sched_yield(); //Every slot is busy
+    }
+  }
+
+  //Apply all published requests (called with the combiner lock held)
+  void combine()
+  {
+    requests.clear();
+    combined.clear();
+    bool modifying = false;
+    size_t used = slots_used.load();
+    for (size_t i = 0; i < used; ++i)
+    {
+      Slot& slot = slots[i];
+      if (slot.state.load(std::memory_order_acquire) != SLOT_PENDING)
+        continue;
+      slot.succeeded = 0;
+      combined.push_back(i);
+      modifying = modifying || (slot.operation != OP_CONTAINS && slot.operation != OP_COLLECT);
+      for (const T* item = slot.begin; item != slot.end; ++item)
+      {
+        Request request = { generate_hash(*item), i, (size_t)(item - slot.begin) };
+        requests.push_back(request);
+      }
+    }
+    std::sort(requests.begin(), requests.end());
+    stats.traversal(requests.size()); //A combining pass counts as a traversal over the requests it applies
+
+    if (!modifying)
+      lookup_requests();
+    else
+      merge_requests();
+
+    //Collect requests see the array with every modification of the pass applied
+    for (size_t i = 0; i < combined.size(); ++i)
+      if (slots[combined[i]].operation == OP_COLLECT)
+        collect_request(slots[combined[i]]);
+
+    //Slots published after the collection stay pending for the next pass
+    for (size_t i = 0; i < combined.size(); ++i)
+      slots[combined[i]].state.store(SLOT_DONE, std::memory_order_release);
+  }
+
+  //Copy the keys range of a collect request
+  void collect_request(Slot& slot)
+  {
+    slot.out->clear();
+    for (typename std::vector<Entry>::const_iterator entry = std::lower_bound(entries.begin(), entries.end(), slot.lo_key, compare_entry_key);
+      entry != entries.end() && entry->key <= slot.hi_key; ++entry)
+      slot.out->push_back(entry->item);
+  }
+
+  //Answer requests that only read by binary searches (the array does not change)
+  void lookup_requests()
+  {
+    typename std::vector<Entry>::iterator position = entries.begin();
+    for (size_t i = 0; i < requests.size(); ++i)
+    {
+      position = std::lower_bound(position, entries.end(), requests[i].key, compare_entry_key);
+      Slot& slot = slots[requests[i].slot];
+      bool found = position != entries.end() && position->key == requests[i].key;
+      slot.results[requests[i].index] = found;
+      if (found)
+        ++slot.succeeded;
+    }
+  }
+
+  //Apply requests in key order building the next array: runs of the array between requested keys are
+  //found by binary search and moved at once
+  void merge_requests()
+  {
+    merged.clear();
+    merged.reserve(entries.size() + requests.size());
+    typename std::vector<Entry>::iterator position = entries.begin();
+    for (size_t i = 0; i < requests.size();)
+    {
+      size_t key = requests[i].key;
+      typename std::vector<Entry>::iterator run_end = std::lower_bound(position, entries.end(), key, compare_entry_key);
+      merged.insert(merged.end(), std::make_move_iterator(position), std::make_move_iterator(run_end));
+      position = run_end;
+
+      //Apply every request for the key in order
+      bool present = position != entries.end() && position->key == key;
+      Entry entry;
+      if (present)
+        entry = std::move(*position++);
+      for (; i < requests.size() && requests[i].key == key; ++i)
+      {
+        Slot& slot = slots[requests[i].slot];
+        bool result = false;
+        if (slot.operation == OP_CONTAINS)
+          result = present;
+        else if (slot.operation == OP_ADD)
+        {
+          result = !present;
+          if (!present)
+          {
+            entry.key = key;
+            if (slot.movable)
+              entry.item = std::move(const_cast<T&>(slot.begin[requests[i].index]));
+            else
+              entry.item = slot.begin[requests[i].index];
+            present = true;
+          }
+        }
+        else
+        {
+          result = present;
+          present = false;
+        }
+        slot.results[requests[i].index] = result;
+        if (result)
+          ++slot.succeeded;
+      }
+      if (present)
+        merged.push_back(entry);
+    }
+    merged.insert(merged.end(), std::make_move_iterator(position), std::make_move_iterator(entries.end()));
+    entries.swap(merged);
+  }
+
+  size_t generate_hash(const T& item)
+  {
+    return std::hash<T>()(item);
+  }
+};
+
+template <class T>
+void(*SetFlatCombining<T>::error_handler)(const char*) = nullptr;
+
+#endif
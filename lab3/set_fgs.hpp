@@ -6,98 +6,77 @@
 #include <bits/stdc++.h>
 
 #include "set.h"
+#include "epoch.hpp"
+#include "snapshot.hpp"
+#include "locks.hpp"
+#include "node_alloc.hpp"
+#include "list_fgs.hpp"
 
-//Fine-grained synchronization set
-template <class T>
-class SetFGS : public Set<T>
+//Fine-grained synchronization set (Lock is a lock policy from locks.hpp, Alloc is a node allocation policy from node_alloc.hpp)
+//The elements are kept in the lock-coupled list engine (see list_fgs.hpp) ordered by (key, element).
+template <class T, class Lock = LockMutex, class Alloc = AllocDefault, class Compare = std::less<T> >
+class SetFGS final : public SetBase<T, SetFGS<T, Lock, Alloc, Compare> >
 {
 public:
   SetFGS()
   {
     if (!error_handler) //Error handler needs to be specified before
       error_handler(g_msg_err_error_handler);
-    //Initialize head of the list and it's next element
-    head = new Node(0);
-    if (!head)
-      error_handler(g_msg_err_node_create);
-    head->next = new Node(INT_MAX);
-    if (!head->next)
-      error_handler(g_msg_err_node_create);
   }
 
-  ~SetFGS()
+  //Build the set of the range elements: the range is sorted once and the nodes are linked in one pass without
+  //locking (nobody else can see the set before the constructor returns)
+  SetFGS(const T* begin, const T* end) : SetFGS()
   {
-    //Delete all elements from the list
-    for (Node *current = head, *next = nullptr; current != nullptr; current = next)
+    std::vector<BatchEntry> batch;
+    Set<T>::sort_batch(begin, end, batch, Compare());
+    Node* last = list.head();
+    size_t added = 0;
+    for (size_t i = 0; i < batch.size(); ++i)
     {
-      next = current->next;
-      delete current;
+      size_t key = batch[i].first;
+      const T& item = begin[batch[i].second];
+      if (i > 0 && batch[i - 1].first == key && Node::equivalent(begin[batch[i - 1].second], item))
+        continue; //Duplicate in the range
+      Node* to_insert = new Node(key, item);
+      if (!to_insert)
+        error_handler(g_msg_err_node_create);
+      to_insert->next = last->next;
+      last->next = to_insert;
+      last = to_insert;
+      ++added;
     }
+    stats.add(SetStats::ALLOCATIONS, added);
   }
 
   bool add(const T& item)
   {
-    //Generate hash for a provided item
-    size_t key = generate_hash(item);
-    //Update _current and _previous so we're in the key position
-    head->lock();
-    Node* _previous = head;
-    Node* _current = head->next;
-    _current->lock();
-    while (_current->key < key)
-    {
-      _previous->unlock();
-      _previous = _current;
-      _current = _current->next;
-      _current->lock();
-    }
-    //If the element is in list then do nothing 
-    if (_current->key == key)
-    {
-      _current->unlock();
-      _previous->unlock();
-      return false;
-    }
+    return insert_item(item);
+  }
 
-    //Insert new element between _previous and _current
-    Node* to_insert = new Node(item);
-    if (!to_insert)
-      error_handler(g_msg_err_error_handler);
-    to_insert->next = _current;
-    _previous->next = to_insert;
-    _current->unlock();
-    _previous->unlock();
-    return true;
+  bool add(T&& item)
+  {
+    return insert_item(std::move(item));
   }
 
   bool remove(const T& item)
   {
+    SnapshotGate::WriteScope write(gate);
     //Generate hash for a provided item
     size_t key = generate_hash(item);
-    //Update _current and _previous so we're in the key position
-    head->lock();
-    Node* _previous = head;
-    Node* _current = head->next;
-    _current->lock();
-    while (_current->key < key)
-    {
-      _previous->unlock();
-      _previous = _current;
-      _current = _current->next;
-      _current->lock();
-    }
-
-    if (_current->key == key)
+    EpochDomain::Guard guard(reclamation);
+    //Lock the nodes around the key position
+    Position position;
+    if (list.locate(key, item, position, stats))
     {
       //Delete if found
-      _previous->next = _current->next;
-      _current->unlock();
-      _previous->unlock();
-      delete _current;
+      List::unlink(position);
+      position.unlock();
+      guard.retire(position.current, delete_node);
+      stats.add(SetStats::RETIREMENTS);
       return true;
     }
-    _current->unlock();
-    _previous->unlock();
+    position.unlock();
     return false;
   }
 
@@ -105,60 +84,212 @@ public:
   {
     //Generate hash for a provided item
     size_t key = generate_hash(item);
-    head->lock();
-    //Update _current and _previous so we're in the key position
-    Node* _previous = head;
-    Node* _current = head->next;
-    _current->lock();
-    while (_current->key < key)
+    //Check the key while the node is still locked (it may be removed and freed right after unlocking)
+    Position position;
+    bool found = list.locate(key, item, position, stats);
+    position.unlock();
+    //Return true if the element was found
+    return found;
+  }
+
+  //Add elements of the range in one hand-over-hand traversal (number of added elements)
+  size_t add_all(const T* begin, const T* end)
+  {
+    SnapshotGate::WriteScope write(gate);
+    std::vector<BatchEntry> batch;
+    Set<T>::sort_batch(begin, end, batch, Compare());
+    size_t added = 0;
+    Position position;
+    list.start(position, stats);
+    size_t steps = 0;
+    for (size_t i = 0; i < batch.size(); ++i)
+    {
+      size_t key = batch[i].first;
+      const T& item = begin[batch[i].second];
+      if (i > 0 && batch[i - 1].first == key && Node::equivalent(begin[batch[i - 1].second], item))
+        continue; //Duplicate in the batch
+      steps += List::advance(position, key, item, stats);
+      if (position.current->holds(key, item))
+        continue;
+
+      //Insert a new node locked, it becomes the previous node for the rest of the batch
+      Node* to_insert = new Node(key, item);
+      if (!to_insert)
+        error_handler(g_msg_err_node_create);
+      stats.add(SetStats::ALLOCATIONS);
+      to_insert->lock(stats);
+      List::link(position, to_insert);
+      position.previous->unlock();
+      position.previous = to_insert;
+      ++added;
+    }
+    stats.traversal(steps);
+    position.unlock();
+    return added;
+  }
+
+  //Remove elements of the range in one hand-over-hand traversal (number of deleted elements)
+  size_t remove_all(const T* begin, const T* end)
+  {
+    SnapshotGate::WriteScope write(gate);
+    std::vector<BatchEntry> batch;
+    Set<T>::sort_batch(begin, end, batch, Compare());
+    EpochDomain::Guard guard(reclamation);
+    size_t removed = 0;
+    Position position;
+    list.start(position, stats);
+    size_t steps = 0;
+    for (size_t i = 0; i < batch.size(); ++i)
+    {
+      size_t key = batch[i].first;
+      const T& item = begin[batch[i].second];
+      steps += List::advance(position, key, item, stats);
+      if (!position.current->holds(key, item))
+        continue;
+
+      //Unlink the node and move to its successor
+      List::unlink(position);
+      position.current->unlock();
+      guard.retire(position.current, delete_node);
+      stats.add(SetStats::RETIREMENTS);
+      position.current = position.previous->next;
+      position.current->lock(stats);
+      ++removed;
+    }
+    stats.traversal(steps);
+    position.unlock();
+    return removed;
+  }
+
+  //Check elements of the range in one hand-over-hand traversal
+  void contains_all(const T* begin, const T* end, bool* out)
+  {
+    std::vector<BatchEntry> batch;
+    Set<T>::sort_batch(begin, end, batch, Compare());
+    Position position;
+    list.start(position, stats);
+    size_t steps = 0;
+    for (size_t i = 0; i < batch.size(); ++i)
     {
-      _previous->unlock();
-      _previous = _current;
-      _current = _current->next;
-      _current->lock();
+      size_t key = batch[i].first;
+      const T& item = begin[batch[i].second];
+      steps += List::advance(position, key, item, stats);
+      out[batch[i].second] = position.current->holds(key, item);
     }
+    stats.traversal(steps);
+    position.unlock();
+  }
 
+  //Remove all elements in one hand-over-hand sweep: the head stays locked, so operations that start later
+  //wait for the sweep and the ones ahead of it are swept after they are done
+  void clear()
+  {
+    SnapshotGate::WriteScope write(gate);
+    EpochDomain::Guard guard(reclamation);
+    Node* head = list.head();
+    head->lock(stats);
+    Node* _current = head->next;
+    _current->lock(stats);
+    size_t removed = 0;
+    while (_current->next != nullptr)
+    {
+      Node* next = _current->next;
+      next->lock(stats);
+      head->next = next;
+      _current->unlock();
+      guard.retire(_current, delete_node);
+      _current = next;
+      ++removed;
+    }
+    stats.add(SetStats::RETIREMENTS, removed);
     _current->unlock();
-    _previous->unlock();
-    //Return true if the element was found
-    return _current->key == key;
+    head->unlock();
+  }
+
+protected:
+  //Copy elements with keys in [lo_key, hi_key] as of one point in time (see snapshot.hpp)
+  void collect(size_t lo_key, size_t hi_key, std::vector<T>& out)
+  {
+    EpochDomain::Guard guard(reclamation);
+    Collector collector = { list.head(), lo_key, hi_key, &out };
+    gate.read(collector);
+  }
+
+public:
+  SetStatistics statistics() const
+  {
+    return stats.get();
+  }
+
+  void reset_statistics()
+  {
+    stats.reset();
   }
 
   static void set_error_handler(void(*handler)(const char*))
   {
     error_handler = handler;
+    List::set_error_handler(handler);
   }
 
 private:
-  class Node
-  {
-  public:
-    Node(T init_value) : item(init_value), key(std::hash<T>()(init_value)), next(nullptr), mutex(PTHREAD_MUTEX_INITIALIZER) {}
+  typedef typename Set<T>::BatchEntry BatchEntry;
+  typedef ListFGS<ItemPayload<T, Compare>, Lock, Alloc> List;
+  typedef typename List::Node Node;
+  typedef typename List::Position Position;
 
-    T item; //Raw data
-    size_t key; //Data key (hash)
-    Node* next; //Pointer to the next node
+  List list; //Elements ordered by (key, element)
+  SnapshotGate gate; //Consistent snapshots against concurrent modifications
+  EpochDomain reclamation; //Removed nodes reclamation (frees them in batches out of the locked path)
+  SetStats stats; //Contention statistics (see set_stats.hpp)
+  static void(*error_handler)(const char*); //Fatal errors handler
 
-                //Lock the node
-    void lock()
+  //Unlocked walk over the list for the snapshot gate
+  struct Collector
+  {
+    Node* head; //Head of the list
+    size_t lo_key, hi_key; //Keys range
+    std::vector<T>* out; //Collected elements
+
+    bool operator()()
     {
-      if (pthread_mutex_lock(&mutex) != 0)
-        error_handler(g_msg_err_mutex_lock);
+      out->clear();
+      for (Node* current = head->next; current->next != nullptr && current->key <= hi_key; current = current->next)
+        if (current->key >= lo_key)
+          out->push_back(current->payload());
+      return true;
     }
+  };
+
+  static void delete_node(void* node)
+  {
+    delete static_cast<Node*>(node);
+  }
 
-    //Unlock the node
-    void unlock()
+  //Add an element copied or moved into the new node
+  template <class U>
+  bool insert_item(U&& item)
+  {
+    SnapshotGate::WriteScope write(gate);
+    //Generate hash for a provided item
+    size_t key = generate_hash(item);
+    //Lock the nodes around the key position, if the element is in list then do nothing
+    Position position;
+    if (list.locate(key, item, position, stats))
     {
-      if (pthread_mutex_unlock(&mutex) != 0)
-        error_handler(g_msg_err_mutex_unlock);
+      position.unlock();
+      return false;
     }
 
-  private:
-    pthread_mutex_t mutex; //Mutex for fine-grained sync
-  };
-
-  Node* head; //Head of the list
-  static void(*error_handler)(const char*); //Fatal errors handler
+    //Insert new element between the nodes of the position
+    Node* to_insert = new Node(key, std::forward<U>(item));
+    if (!to_insert)
+      error_handler(g_msg_err_node_create);
+    stats.add(SetStats::ALLOCATIONS);
+    List::link(position, to_insert);
+    position.unlock();
+    return true;
+  }
 
   size_t generate_hash(const T& item)
   {
@@ -166,8 +297,7 @@ private:
   }
 };
 
-template <class T>
-void(*SetFGS<T>::error_handler)(const char*) = nullptr;
+template <class T, class Lock, class Alloc, class Compare>
+void(*SetFGS<T, Lock, Alloc, Compare>::error_handler)(const char*) = nullptr;
 
 #endif
-
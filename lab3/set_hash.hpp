@@ -0,0 +1,441 @@
+
+#ifndef SET_HASH_RPLDKW__
+#define SET_HASH_RPLDKW__
+
+#include <functional>
+#include <atomic>
+#include <cstdint>
+#include <bits/stdc++.h>
+
+#include "set.h"
+#include "hazard_pointers.hpp"
+#include "snapshot.hpp"
+
+//Lock-free split-ordered hash set
+//All items are kept in one lock-free list sorted by bit-reversed hash. Buckets are shortcuts (dummy nodes)
+//into that list, so doubling the buckets number only splits buckets lazily and never moves items.
+template <class T>
+class SetHash final : public SetBase<T, SetHash<T> >
+{
+public:
+  static const size_t INITIAL_BUCKETS = 2; //Initial buckets number (power of two)
+  static const size_t LOAD_FACTOR = 2; //Average bucket length that triggers buckets number doubling
+
+  SetHash() : buckets_number(INITIAL_BUCKETS), items_number(0)
+  {
+    if (!error_handler) //Error handler needs to be specified before
+      error_handler(g_msg_err_error_handler);
+    for (size_t i = 0; i < SEGMENTS; ++i)
+      segments[i].store(nullptr, std::memory_order_relaxed);
+    //Bucket 0 dummy node is the head of the list
+    Node* head = new Node(T(), 0, dummy_key(0));
+    if (!head)
+      error_handler(g_msg_err_node_create);
+    get_bucket_slot(0)->store(head, std::memory_order_release);
+  }
+
+  ~SetHash()
+  {
+    //Delete all elements and dummy nodes from the list
+    for (Node *current = get_bucket_slot(0)->load(std::memory_order_relaxed), *next = nullptr; current != nullptr; current = next)
+    {
+      next = get_node(current->next.load(std::memory_order_relaxed));
+      delete current;
+    }
+    for (size_t i = 0; i < SEGMENTS; ++i)
+      delete[] segments[i].load(std::memory_order_relaxed);
+  }
+
+  bool add(const T& item)
+  {
+    return insert_item(item);
+  }
+
+  bool add(T&& item)
+  {
+    return insert_item(std::move(item));
+  }
+
+  bool remove(const T& item)
+  {
+    SnapshotGate::WriteScope write(gate);
+    size_t key = generate_hash(item);
+    size_t so_key = regular_key(key);
+    typename Domain::Guard guard(domain);
+    Node* bucket = get_bucket(key & (buckets_number.load(std::memory_order_relaxed) - 1), guard);
+    while (true)
+    {
+      Position position;
+      if (!find(guard, bucket, so_key, key, position))
+        return false;
+      uintptr_t next = position.current->next.load();
+      if (is_marked(next) || !position.current->next.compare_exchange_strong(next, next | MARK_BIT))
+      {
+        stats.add(SetStats::RETRIES);
+        continue;
+      }
+      uintptr_t expected = make_link(position.current, false);
+      if (position.previous->compare_exchange_strong(expected, next))
+      {
+        guard.retire(position.current);
+        stats.add(SetStats::RETIREMENTS);
+      }
+      else
+        find(guard, bucket, so_key, key, position);
+      items_number.fetch_sub(1, std::memory_order_relaxed);
+      return true;
+    }
+  }
+
+  bool contains(const T& item)
+  {
+    size_t key = generate_hash(item);
+    typename Domain::Guard guard(domain);
+    Node* bucket = get_bucket(key & (buckets_number.load(std::memory_order_relaxed) - 1), guard);
+    Position position;
+    return find(guard, bucket, regular_key(key), key, position);
+  }
+
+protected:
+  //Copy elements with keys in [lo_key, hi_key] as of one point in time (see snapshot.hpp)
+  //The list is in split order, so the whole list is scanned and the result is sorted by key
+  void collect(size_t lo_key, size_t hi_key, std::vector<T>& out)
+  {
+    std::vector<KeyedItem> items;
+    Collector collector = { &domain, get_bucket_slot(0)->load(std::memory_order_acquire), lo_key, hi_key, &items };
+    gate.read(collector);
+    std::sort(items.begin(), items.end(), compare_keyed_items);
+    out.clear();
+    for (size_t i = 0; i < items.size(); ++i)
+      out.push_back(items[i].second);
+  }
+
+public:
+  SetStatistics statistics() const
+  {
+    return stats.get();
+  }
+
+  void reset_statistics()
+  {
+    stats.reset();
+  }
+
+  static void set_error_handler(void(*handler)(const char*))
+  {
+    error_handler = handler;
+  }
+
+private:
+  class Node
+  {
+  public:
+    template <class U>
+    Node(U&& init_value, size_t init_key, size_t init_so_key) : item(std::forward<U>(init_value)), key(init_key), so_key(init_so_key), next(0) {}
+
+    T item; //Raw data (unused in dummy nodes)
+    size_t key; //Data key (hash)
+    size_t so_key; //Split-order key (bit-reversed hash, odd for items and even for dummy nodes)
+    std::atomic<uintptr_t> next; //Pointer to the next node with a deletion mark in the lowest bit
+  };
+
+  typedef HazardDomain<Node, 3> Domain;
+
+  //Hazard pointers indices
+  enum { HP_NEXT = 0, HP_CURRENT = 1, HP_PREVIOUS = 2 };
+
+  static const uintptr_t MARK_BIT = 1;
+  //Buckets table consists of segments of sizes 1, 1, 2, 4, 8, ... so it grows without moving buckets
+  static const size_t SEGMENTS = sizeof(size_t) * CHAR_BIT;
+  static const size_t MAX_BUCKETS = (size_t)1 << (SEGMENTS - 2);
+
+  //Key position in the list
+  struct Position
+  {
+    std::atomic<uintptr_t>* previous; //Link that points to current
+    Node* current; //First node not less than the searched one
+  };
+
+  std::atomic<std::atomic<Node*>*> segments[SEGMENTS]; //Buckets table segments
+  std::atomic<size_t> buckets_number; //Current buckets number
+  std::atomic<size_t> items_number; //Current items number
+  SnapshotGate gate; //Consistent snapshots against concurrent modifications
+  Domain domain; //Removed nodes reclamation
+  SetStats stats; //Contention statistics (see set_stats.hpp)
+  static void(*error_handler)(const char*); //Fatal errors handler
+
+  static Node* get_node(uintptr_t link)
+  {
+    return reinterpret_cast<Node*>(link & ~MARK_BIT);
+  }
+
+  static bool is_marked(uintptr_t link)
+  {
+    return (link & MARK_BIT) != 0;
+  }
+
+  static uintptr_t make_link(Node* node, bool marked)
+  {
+    return reinterpret_cast<uintptr_t>(node) | (marked ? MARK_BIT : 0);
+  }
+
+  static size_t reverse_bits(size_t value)
+  {
+    size_t result = 0;
+    for (size_t i = 0; i < SEGMENTS; ++i, value >>= 1)
+      result = (result << 1) | (value & 1);
+    return result;
+  }
+
+  static size_t regular_key(size_t key)
+  {
+    return reverse_bits(key) | 1;
+  }
+
+  static size_t dummy_key(size_t bucket)
+  {
+    return reverse_bits(bucket);
+  }
+
+  //Get a bucket parent (the bucket it is split from)
+  static size_t get_parent(size_t bucket)
+  {
+    size_t bit = (size_t)1 << (SEGMENTS - 1);
+    while (!(bucket & bit))
+      bit >>= 1;
+    return bucket & ~bit;
+  }
+
+  //Get a bucket slot in the table allocating its segment if needed
+  std::atomic<Node*>* get_bucket_slot(size_t bucket)
+  {
+    size_t segment = 0, segment_size = 1, offset = bucket;
+    if (bucket)
+    {
+      //Segment i > 0 holds buckets [2^(i - 1), 2^i)
+      while ((bucket >> segment) > 1)
+        ++segment;
+      segment_size = (size_t)1 << segment;
+      offset = bucket - segment_size;
+      ++segment;
+    }
+
+    std::atomic<Node*>* slots = segments[segment].load(std::memory_order_acquire);
+    if (!slots)
+    {
+      std::atomic<Node*>* allocated = new std::atomic<Node*>[segment_size];
+      if (!allocated)
+        error_handler(g_msg_err_node_create);
+      for (size_t i = 0; i < segment_size; ++i)
+        allocated[i].store(nullptr, std::memory_order_relaxed);
+      if (segments[segment].compare_exchange_strong(slots, allocated, std::memory_order_acq_rel))
+        slots = allocated;
+      else
+        delete[] allocated;
+    }
+    return slots + offset;
+  }
+
+  //Get a bucket dummy node initializing the bucket if needed
+  Node* get_bucket(size_t bucket, typename Domain::Guard& guard)
+  {
+    std::atomic<Node*>* slot = get_bucket_slot(bucket);
+    Node* dummy = slot->load(std::memory_order_acquire);
+    if (dummy)
+      return dummy;
+
+    //Split the parent bucket by inserting a dummy node into its part of the list
+    Node* parent = get_bucket(get_parent(bucket), guard);
+    size_t so_key = dummy_key(bucket);
+    Node* to_insert = new Node(T(), 0, so_key);
+    if (!to_insert)
+      error_handler(g_msg_err_node_create);
+    stats.add(SetStats::ALLOCATIONS);
+    while (true)
+    {
+      Position position;
+      if (find(guard, parent, so_key, 0, position))
+      {
+        //Another thread has inserted the dummy node
+        delete to_insert;
+        dummy = position.current;
+        break;
+      }
+      to_insert->next.store(make_link(position.current, false), std::memory_order_relaxed);
+      uintptr_t expected = make_link(position.current, false);
+      if (position.previous->compare_exchange_strong(expected, make_link(to_insert, false)))
+      {
+        dummy = to_insert;
+        break;
+      }
+    }
+    slot->store(dummy, std::memory_order_release);
+    return dummy;
+  }
+
+  //Whether a node goes before the (so_key, key) pair in the list
+  static bool is_less(Node* node, size_t so_key, size_t key)
+  {
+    return node->so_key < so_key || (node->so_key == so_key && node->key < key);
+  }
+
+  //Find the key position after the start node unlinking marked nodes on the way (true if the key is in the list)
+  bool find(typename Domain::Guard& guard, Node* start, size_t so_key, size_t key, Position& position)
+  {
+    size_t steps = 0;
+    while (true)
+    {
+      std::atomic<uintptr_t>* previous = &start->next;
+      Node* current = get_node(previous->load());
+      guard.protect(HP_CURRENT, current);
+      if (previous->load() != make_link(current, false))
+        continue;
+
+      bool restart = false;
+      while (!restart)
+      {
+        if (!current)
+        {
+          position.previous = previous;
+          position.current = nullptr;
+          stats.traversal(steps);
+          return false;
+        }
+        uintptr_t next = current->next.load();
+        guard.protect(HP_NEXT, get_node(next));
+        //Check that current is still linked to previous and next is still linked to current
+        if (current->next.load() != next || previous->load() != make_link(current, false))
+        {
+          stats.add(SetStats::RETRIES);
+          restart = true;
+          continue;
+        }
+
+        if (!is_marked(next))
+        {
+          if (!is_less(current, so_key, key))
+          {
+            position.previous = previous;
+            position.current = current;
+            stats.traversal(steps);
+            return current->so_key == so_key && current->key == key;
+          }
+          previous = &current->next;
+          guard.protect(HP_PREVIOUS, current);
+        }
+        else
+        {
+          //Help to unlink a removed node
+          uintptr_t expected = make_link(current, false);
+          if (!previous->compare_exchange_strong(expected, make_link(get_node(next), false)))
+          {
+            stats.add(SetStats::RETRIES);
+            restart = true;
+            continue;
+          }
+          guard.retire(current);
+          stats.add(SetStats::RETIREMENTS);
+        }
+        current = get_node(next);
+        guard.protect(HP_CURRENT, current);
+        ++steps;
+      }
+    }
+  }
+
+  //Element with its key
+  typedef std::pair<size_t, T> KeyedItem;
+
+  static bool compare_keyed_items(const KeyedItem& first, const KeyedItem& second)
+  {
+    return first.first < second.first;
+  }
+
+  //Hazard-protected walk over the list for the snapshot gate (fails on a node that is being removed)
+  struct Collector
+  {
+    Domain* domain; //Hazard pointers domain
+    Node* start; //Node to start after
+    size_t lo_key, hi_key; //Keys range
+    std::vector<KeyedItem>* out; //Collected elements
+
+    bool operator()()
+    {
+      out->clear();
+      typename Domain::Guard guard(*domain);
+      std::atomic<uintptr_t>* previous = &start->next;
+      Node* current = get_node(previous->load());
+      guard.protect(HP_CURRENT, current);
+      if (previous->load() != make_link(current, false))
+        return false;
+      while (current)
+      {
+        uintptr_t next = current->next.load();
+        guard.protect(HP_NEXT, get_node(next));
+        if (is_marked(next) || current->next.load() != next || previous->load() != make_link(current, false))
+          return false;
+        if ((current->so_key & 1) && current->key >= lo_key && current->key <= hi_key)
+          out->push_back(KeyedItem(current->key, current->item));
+        previous = &current->next;
+        guard.protect(HP_PREVIOUS, current);
+        current = get_node(next);
+        guard.protect(HP_CURRENT, current);
+      }
+      return true;
+    }
+  };
+
+  //Add an element copied or moved into the new node
+  template <class U>
+  bool insert_item(U&& item)
+  {
+    SnapshotGate::WriteScope write(gate);
+    size_t key = generate_hash(item);
+    size_t so_key = regular_key(key);
+    typename Domain::Guard guard(domain);
+    Node* bucket = get_bucket(key & (buckets_number.load(std::memory_order_relaxed) - 1), guard);
+    Node* to_insert = nullptr;
+    while (true)
+    {
+      Position position;
+      if (find(guard, bucket, so_key, key, position))
+      {
+        if (to_insert)
+        {
+          Set<T>::give_back(std::forward<U>(item), to_insert->item);
+          delete to_insert;
+        }
+        return false;
+      }
+      if (!to_insert)
+      {
+        to_insert = new Node(std::forward<U>(item), key, so_key);
+        if (!to_insert)
+          error_handler(g_msg_err_node_create);
+        stats.add(SetStats::ALLOCATIONS);
+      }
+      to_insert->next.store(make_link(position.current, false), std::memory_order_relaxed);
+      uintptr_t expected = make_link(position.current, false);
+      if (position.previous->compare_exchange_strong(expected, make_link(to_insert, false)))
+        break;
+      stats.add(SetStats::RETRIES);
+    }
+
+    //Double the buckets number if the load factor is exceeded
+    size_t items = items_number.fetch_add(1, std::memory_order_relaxed) + 1;
+    size_t buckets = buckets_number.load(std::memory_order_relaxed);
+    if (items / buckets > LOAD_FACTOR && buckets < MAX_BUCKETS)
+      buckets_number.compare_exchange_strong(buckets, buckets * 2, std::memory_order_relaxed);
+    return true;
+  }
+
+  size_t generate_hash(const T& item)
+  {
+    return std::hash<T>()(item);
+  }
+};
+
+template <class T>
+void(*SetHash<T>::error_handler)(const char*) = nullptr;
+
+#endif
@@ -0,0 +1,210 @@
+
+#ifndef SET_IMAGE_HWQZNB__
+#define SET_IMAGE_HWQZNB__
+
+#include <functional>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <type_traits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "set.h"
+
+//On-disk image of a set of trivially copyable elements, opened by mmap
+//Layout (all positions are offsets from the start of the file, so the image does not depend on where it is mapped):
+//  header (64 bytes) | keys: count hashes in key order | padding to 64 bytes | items: count elements in the keys order
+//Pages are read in by the first access, so opening is constant time and loading scans both arrays sequentially.
+template <class T>
+class SetImage
+{
+public:
+  static_assert(std::is_trivially_copyable<T>::value, "Image elements must be trivially copyable");
+
+  static const uint32_t VERSION = 1;
+
+  SetImage() : base(nullptr), length(0), header(nullptr) {}
+
+  ~SetImage()
+  {
+    close();
+  }
+
+  //Write the elements of the set as of one point in time (false on an I/O error)
+  //The image is written next to the path and renamed over it, so readers never see a partial file.
+  static bool save(Set<T>& set, const char* path)
+  {
+    std::vector<T> items;
+    set.snapshot(items);
+    std::vector<uint64_t> keys;
+    keys.reserve(items.size());
+    for (size_t i = 0; i < items.size(); ++i)
+      keys.push_back(std::hash<T>()(items[i]));
+
+    Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MAGIC, sizeof(header.magic));
+    header.version = VERSION;
+    header.item_size = sizeof(T);
+    header.count = items.size();
+    header.keys_offset = sizeof(Header);
+    header.items_offset = align(header.keys_offset + keys.size() * sizeof(uint64_t));
+
+    std::string temporary = std::string(path) + ".tmp";
+    FILE* file = fopen(temporary.c_str(), "wb");
+    if (!file)
+      return false;
+    static const char padding[ALIGNMENT] = {};
+    size_t padding_size = header.items_offset - header.keys_offset - keys.size() * sizeof(uint64_t);
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+      fwrite(keys.data(), sizeof(uint64_t), keys.size(), file) == keys.size() &&
+      fwrite(padding, 1, padding_size, file) == padding_size &&
+      fwrite(items.data(), sizeof(T), items.size(), file) == items.size() &&
+      fflush(file) == 0 && fsync(fileno(file)) == 0;
+    if (fclose(file) != 0 || !written || rename(temporary.c_str(), path) != 0)
+    {
+      unlink(temporary.c_str());
+      return false;
+    }
+    return true;
+  }
+
+  //Map an image (false if it can not be read or is not an image of T)
+  bool open(const char* path)
+  {
+    close();
+    int file = ::open(path, O_RDONLY);
+    if (file < 0)
+      return false;
+    struct stat status;
+    void* mapped = MAP_FAILED;
+    if (fstat(file, &status) == 0 && (size_t)status.st_size >= sizeof(Header))
+      mapped = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    ::close(file); //The mapping keeps the file
+    if (mapped == MAP_FAILED)
+      return false;
+    base = static_cast<const char*>(mapped);
+    length = status.st_size;
+    header = reinterpret_cast<const Header*>(base);
+    if (!valid())
+    {
+      close();
+      return false;
+    }
+    madvise(mapped, length, MADV_SEQUENTIAL);
+    return true;
+  }
+
+  void close()
+  {
+    if (base)
+      munmap(const_cast<char*>(base), length);
+    base = nullptr;
+    length = 0;
+    header = nullptr;
+  }
+
+  //Number of elements (0 if no image is open)
+  size_t size() const
+  {
+    return header ? header->count : 0;
+  }
+
+  //Keys (hashes) of the elements in ascending order
+  const uint64_t* keys() const
+  {
+    return header ? reinterpret_cast<const uint64_t*>(base + header->keys_offset) : nullptr;
+  }
+
+  //Elements in the keys order
+  const T* begin() const
+  {
+    return header ? reinterpret_cast<const T*>(base + header->items_offset) : nullptr;
+  }
+
+  const T* end() const
+  {
+    return begin() + size();
+  }
+
+  //Add the elements to any set with one batch (number of added elements)
+  size_t load(Set<T>& set) const
+  {
+    return set.add_all(begin(), end());
+  }
+
+  //Create a set of type S holding the elements: with its range constructor if it has one (the list sets
+  //link the elements without locking), otherwise an empty set filled with one batch (nullptr on failure)
+  template <class S>
+  S* create() const
+  {
+    return create<S>(std::is_constructible<S, const T*, const T*>());
+  }
+
+private:
+  static const size_t ALIGNMENT = 64; //Alignment of the arrays
+  static const char MAGIC[8];
+
+  struct Header
+  {
+    char magic[8]; //MAGIC
+    uint32_t version; //Format version
+    uint32_t item_size; //sizeof(T) of the writer
+    uint64_t count; //Number of elements
+    uint64_t keys_offset; //Position of the keys array
+    uint64_t items_offset; //Position of the items array
+    char reserved[24];
+  };
+
+  static_assert(sizeof(Header) == 64, "Image header must take 64 bytes");
+
+  const char* base; //Mapped file
+  size_t length; //Mapped length
+  const Header* header; //Header of the mapped image
+
+  SetImage(const SetImage&) = delete;
+  SetImage& operator=(const SetImage&) = delete;
+
+  template <class S>
+  S* create(std::true_type) const
+  {
+    return new S(begin(), end());
+  }
+
+  template <class S>
+  S* create(std::false_type) const
+  {
+    S* set = new S();
+    if (set)
+      load(*set);
+    return set;
+  }
+
+  static uint64_t align(uint64_t offset)
+  {
+    return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+  }
+
+  //Check the header against the file length before any array is touched
+  bool valid() const
+  {
+    if (memcmp(header->magic, MAGIC, sizeof(header->magic)) != 0 || header->version != VERSION || header->item_size != sizeof(T))
+      return false;
+    if (header->keys_offset < sizeof(Header) || header->keys_offset % ALIGNMENT || header->items_offset % ALIGNMENT)
+      return false;
+    if (header->count > length / sizeof(uint64_t) || header->count > length / sizeof(T))
+      return false;
+    return header->keys_offset + header->count * sizeof(uint64_t) <= header->items_offset &&
+      header->items_offset <= length && header->count * sizeof(T) <= length - header->items_offset;
+  }
+};
+
+template <class T>
+const char SetImage<T>::MAGIC[8] = { 'L', 'A', 'B', '3', 'S', 'E', 'T', 0 };
+
+#endif
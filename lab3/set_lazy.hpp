@@ -0,0 +1,458 @@
+
+#ifndef SET_LAZY_QPWMZA__
+#define SET_LAZY_QPWMZA__
+
+#include <functional>
+#include <atomic>
+#include <pthread.h>
+#include <bits/stdc++.h>
+
+#include "set.h"
+#include "epoch.hpp"
+#include "snapshot.hpp"
+
+//Lazy synchronization set
+template <class T>
+class SetLazy final : public SetBase<T, SetLazy<T> >
+{
+public:
+  SetLazy()
+  {
+    if (!error_handler) //Error handler needs to be specified before
+      error_handler(g_msg_err_error_handler);
+    //Initialize head of the list and it's next element
+    head = new Node(Node::RANK_HEAD);
+    if (!head)
+      error_handler(g_msg_err_node_create);
+    head->next.store(new Node(Node::RANK_TAIL), std::memory_order_relaxed);
+    if (!head->next.load(std::memory_order_relaxed))
+      error_handler(g_msg_err_node_create);
+  }
+
+  //Build the set of the range elements: the range is sorted once and the nodes are linked in one pass without
+  //locking (nobody else can see the set before the constructor returns)
+  SetLazy(const T* begin, const T* end) : SetLazy()
+  {
+    std::vector<BatchEntry> batch;
+    Set<T>::sort_batch(begin, end, batch);
+    Node* last = head;
+    size_t added = 0;
+    for (size_t i = 0; i < batch.size(); ++i)
+    {
+      if (i > 0 && batch[i - 1].first == batch[i].first)
+        continue; //Duplicate in the range
+      Node* to_insert = new Node(begin[batch[i].second]);
+      if (!to_insert)
+        error_handler(g_msg_err_node_create);
+      to_insert->next.store(last->next.load(std::memory_order_relaxed), std::memory_order_relaxed);
+      last->next.store(to_insert, std::memory_order_relaxed);
+      last = to_insert;
+      ++added;
+    }
+    stats.add(SetStats::ALLOCATIONS, added);
+  }
+
+  ~SetLazy()
+  {
+    //Delete all elements from the list
+    for (Node *current = head, *next = nullptr; current != nullptr; current = next)
+    {
+      next = current->next.load(std::memory_order_relaxed);
+      delete current;
+    }
+  }
+
+  bool add(const T& item)
+  {
+    return insert_item(item);
+  }
+
+  bool add(T&& item)
+  {
+    return insert_item(std::move(item));
+  }
+
+  bool remove(const T& item)
+  {
+    SnapshotGate::WriteScope write(gate);
+    size_t key = generate_hash(item);
+    EpochDomain::Guard guard(reclamation);
+    while (true)
+    {
+      //Update _current and _previous so we're in the key position
+      Node* _previous = head;
+      Node* _current = head->next.load(std::memory_order_acquire);
+      size_t steps = 0;
+      while (_current->before(key))
+      {
+        ++steps;
+        _previous = _current;
+        _current = _current->next.load(std::memory_order_acquire);
+      }
+      stats.traversal(steps);
+
+      _previous->lock(stats);
+      _current->lock(stats);
+      //Check that both nodes are alive and _previous still points to _current
+      if (validate(_previous, _current))
+      {
+        if (!_current->holds(key))
+        {
+          _current->unlock();
+          _previous->unlock();
+          return false;
+        }
+        //Mark the node as deleted first (logical removal), then unlink it
+        _current->marked.store(true, std::memory_order_release);
+        _previous->next.store(_current->next.load(std::memory_order_relaxed), std::memory_order_release);
+        _current->unlock();
+        _previous->unlock();
+        guard.retire(_current, delete_node);
+        stats.add(SetStats::RETIREMENTS);
+        return true;
+      }
+      _current->unlock();
+      _previous->unlock();
+      stats.add(SetStats::RETRIES);
+    }
+  }
+
+  //Wait-free check: no locks and no retries
+  bool contains(const T& item)
+  {
+    size_t key = generate_hash(item);
+    EpochDomain::Guard guard(reclamation);
+    Node* _current = head->next.load(std::memory_order_acquire);
+    size_t steps = 0;
+    while (_current->before(key))
+    {
+      ++steps;
+      _current = _current->next.load(std::memory_order_acquire);
+    }
+    stats.traversal(steps);
+    return _current->holds(key) && !_current->marked.load(std::memory_order_acquire);
+  }
+
+  //Add elements of the range in one hand-over-hand traversal (number of added elements)
+  size_t add_all(const T* begin, const T* end)
+  {
+    SnapshotGate::WriteScope write(gate);
+    std::vector<BatchEntry> batch;
+    Set<T>::sort_batch(begin, end, batch);
+    size_t added = 0;
+    head->lock(stats);
+    Node* _previous = head;
+    Node* _current = head->next.load(std::memory_order_acquire);
+    _current->lock(stats);
+    size_t steps = 0;
+    for (size_t i = 0; i < batch.size(); ++i)
+    {
+      size_t key = batch[i].first;
+      if (i > 0 && batch[i - 1].first == key)
+        continue; //Duplicate in the batch
+      while (_current->before(key))
+      {
+        ++steps;
+        _previous->unlock();
+        _previous = _current;
+        _current = _current->next.load(std::memory_order_acquire);
+        _current->lock(stats);
+      }
+      if (_current->holds(key))
+        continue;
+
+      //Insert a new node locked, it becomes _previous for the rest of the batch
+      Node* to_insert = new Node(begin[batch[i].second]);
+      if (!to_insert)
+        error_handler(g_msg_err_node_create);
+      stats.add(SetStats::ALLOCATIONS);
+      to_insert->lock(stats);
+      to_insert->next.store(_current, std::memory_order_relaxed);
+      _previous->next.store(to_insert, std::memory_order_release);
+      _previous->unlock();
+      _previous = to_insert;
+      ++added;
+    }
+    stats.traversal(steps);
+    _current->unlock();
+    _previous->unlock();
+    return added;
+  }
+
+  //Remove elements of the range in one hand-over-hand traversal (number of deleted elements)
+  size_t remove_all(const T* begin, const T* end)
+  {
+    SnapshotGate::WriteScope write(gate);
+    std::vector<BatchEntry> batch;
+    Set<T>::sort_batch(begin, end, batch);
+    EpochDomain::Guard guard(reclamation);
+    size_t removed = 0;
+    head->lock(stats);
+    Node* _previous = head;
+    Node* _current = head->next.load(std::memory_order_acquire);
+    _current->lock(stats);
+    size_t steps = 0;
+    for (size_t i = 0; i < batch.size(); ++i)
+    {
+      size_t key = batch[i].first;
+      while (_current->before(key))
+      {
+        ++steps;
+        _previous->unlock();
+        _previous = _current;
+        _current = _current->next.load(std::memory_order_acquire);
+        _current->lock(stats);
+      }
+      if (!_current->holds(key))
+        continue;
+
+      //Mark and unlink the node, then move to its successor
+      _current->marked.store(true, std::memory_order_release);
+      _previous->next.store(_current->next.load(std::memory_order_relaxed), std::memory_order_release);
+      _current->unlock();
+      guard.retire(_current, delete_node);
+      stats.add(SetStats::RETIREMENTS);
+      _current = _previous->next.load(std::memory_order_relaxed);
+      _current->lock(stats);
+      ++removed;
+    }
+    stats.traversal(steps);
+    _current->unlock();
+    _previous->unlock();
+    return removed;
+  }
+
+  //Check elements of the range in one traversal without locks
+  void contains_all(const T* begin, const T* end, bool* out)
+  {
+    std::vector<BatchEntry> batch;
+    Set<T>::sort_batch(begin, end, batch);
+    EpochDomain::Guard guard(reclamation);
+    Node* _current = head->next.load(std::memory_order_acquire);
+    size_t steps = 0;
+    for (size_t i = 0; i < batch.size(); ++i)
+    {
+      size_t key = batch[i].first;
+      while (_current->before(key))
+      {
+        ++steps;
+        _current = _current->next.load(std::memory_order_acquire);
+      }
+      out[batch[i].second] = _current->holds(key) && !_current->marked.load(std::memory_order_acquire);
+    }
+    stats.traversal(steps);
+  }
+
+  //Remove all elements in one hand-over-hand sweep from the head: every node is marked before it is
+  //unlinked, so wait-free readers that are still on it see it as removed
+  void clear()
+  {
+    SnapshotGate::WriteScope write(gate);
+    EpochDomain::Guard guard(reclamation);
+    head->lock(stats);
+    Node* _current = head->next.load(std::memory_order_acquire);
+    _current->lock(stats);
+    size_t removed = 0;
+    for (Node* next; (next = _current->next.load(std::memory_order_relaxed)) != nullptr; _current = next)
+    {
+      next->lock(stats);
+      _current->marked.store(true, std::memory_order_release);
+      head->next.store(next, std::memory_order_release);
+      _current->unlock();
+      guard.retire(_current, delete_node);
+      ++removed;
+    }
+    stats.add(SetStats::RETIREMENTS, removed);
+    _current->unlock();
+    head->unlock();
+  }
+
+protected:
+  //Copy elements with keys in [lo_key, hi_key] as of one point in time (see snapshot.hpp)
+  void collect(size_t lo_key, size_t hi_key, std::vector<T>& out)
+  {
+    EpochDomain::Guard guard(reclamation);
+    Collector collector = { head, lo_key, hi_key, &out };
+    gate.read(collector);
+  }
+
+public:
+  SetStatistics statistics() const
+  {
+    return stats.get();
+  }
+
+  void reset_statistics()
+  {
+    stats.reset();
+  }
+
+  static void set_error_handler(void(*handler)(const char*))
+  {
+    error_handler = handler;
+  }
+
+private:
+  typedef typename Set<T>::BatchEntry BatchEntry;
+
+  class Node
+  {
+  public:
+    enum Rank { RANK_HEAD, RANK_ITEM, RANK_TAIL };
+
+    //Sentinel: the head comes before and the tail after every element, whatever its key
+    explicit Node(Rank init_rank) : key(init_rank == RANK_HEAD ? 0 : SIZE_MAX), rank(init_rank), next(nullptr), marked(false), mutex(PTHREAD_MUTEX_INITIALIZER) {}
+
+    //Element node
+    template <class U>
+    Node(U&& init_value) : rank(RANK_ITEM), next(nullptr), marked(false), mutex(PTHREAD_MUTEX_INITIALIZER)
+    {
+      new (&storage) T(std::forward<U>(init_value));
+      key = std::hash<T>()(item());
+    }
+
+    ~Node()
+    {
+      if (rank == RANK_ITEM)
+        item().~T();
+    }
+
+    size_t key; //Data key (hash)
+    Rank rank; //Sentinel or element
+    std::atomic<Node*> next; //Pointer to the next node
+    std::atomic<bool> marked; //Logical deletion mark
+
+    //Raw data (element nodes only)
+    T& item()
+    {
+      return *reinterpret_cast<T*>(&storage);
+    }
+
+    //Whether the node comes before the key
+    bool before(size_t other_key) const
+    {
+      return key < other_key || (key == other_key && rank == RANK_HEAD);
+    }
+
+    //Whether the node holds an element with the key
+    bool holds(size_t other_key) const
+    {
+      return key == other_key && rank == RANK_ITEM;
+    }
+
+    //Lock the node
+    void lock(SetStats& stats)
+    {
+      SetStats::LockTiming timing(stats);
+      if (pthread_mutex_lock(&mutex) != 0)
+        error_handler(g_msg_err_mutex_lock);
+    }
+
+    //Unlock the node
+    void unlock()
+    {
+      if (pthread_mutex_unlock(&mutex) != 0)
+        error_handler(g_msg_err_mutex_unlock);
+    }
+
+  private:
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type storage; //Raw data (element nodes only)
+    pthread_mutex_t mutex; //Mutex for a node lock
+  };
+
+  Node* head; //Head of the list
+  SnapshotGate gate; //Consistent snapshots against concurrent modifications
+  EpochDomain reclamation; //Removed nodes reclamation (lock-free readers may still walk them)
+  SetStats stats; //Contention statistics (see set_stats.hpp)
+  static void(*error_handler)(const char*); //Fatal errors handler
+
+  //Unlocked walk over the list for the snapshot gate
+  struct Collector
+  {
+    Node* head; //Head of the list
+    size_t lo_key, hi_key; //Keys range
+    std::vector<T>* out; //Collected elements
+
+    bool operator()()
+    {
+      out->clear();
+      Node* current = head->next.load(std::memory_order_acquire);
+      for (Node* next; (next = current->next.load(std::memory_order_acquire)) != nullptr && current->key <= hi_key; current = next)
+        if (current->key >= lo_key && !current->marked.load(std::memory_order_acquire))
+          out->push_back(current->item());
+      return true;
+    }
+  };
+
+  static void delete_node(void* node)
+  {
+    delete static_cast<Node*>(node);
+  }
+
+  //Validate that both nodes are not deleted and _previous points to _current
+  bool validate(Node* previous, Node* current)
+  {
+    return !previous->marked.load(std::memory_order_relaxed) && !current->marked.load(std::memory_order_relaxed) &&
+      previous->next.load(std::memory_order_relaxed) == current;
+  }
+
+  //Add an element copied or moved into the new node
+  template <class U>
+  bool insert_item(U&& item)
+  {
+    SnapshotGate::WriteScope write(gate);
+    size_t key = generate_hash(item);
+    EpochDomain::Guard guard(reclamation);
+    while (true)
+    {
+      //Update _current and _previous so we're in the key position
+      Node* _previous = head;
+      Node* _current = head->next.load(std::memory_order_acquire);
+      size_t steps = 0;
+      while (_current->before(key))
+      {
+        ++steps;
+        _previous = _current;
+        _current = _current->next.load(std::memory_order_acquire);
+      }
+      stats.traversal(steps);
+
+      //Lock the nodes under the position
+      _previous->lock(stats);
+      _current->lock(stats);
+      //Check that both nodes are alive and _previous still points to _current
+      if (validate(_previous, _current))
+      {
+        if (_current->holds(key))
+        {
+          _current->unlock();
+          _previous->unlock();
+          return false;
+        }
+        //Insert a new node
+        Node* to_insert = new Node(std::forward<U>(item));
+        if (!to_insert)
+          error_handler(g_msg_err_node_create);
+        stats.add(SetStats::ALLOCATIONS);
+        to_insert->next.store(_current, std::memory_order_relaxed);
+        _previous->next.store(to_insert, std::memory_order_release);
+        _current->unlock();
+        _previous->unlock();
+        return true;
+      }
+      _current->unlock();
+      _previous->unlock();
+      stats.add(SetStats::RETRIES);
+    }
+  }
+
+  size_t generate_hash(const T& item)
+  {
+    return std::hash<T>()(item);
+  }
+};
+
+template <class T>
+void(*SetLazy<T>::error_handler)(const char*) = nullptr;
+
+#endif
@@ -0,0 +1,444 @@
+
+#ifndef SET_LF_MVNXQE__
+#define SET_LF_MVNXQE__
+
+#include <functional>
+#include <atomic>
+#include <cstdint>
+#include <bits/stdc++.h>
+
+#include "set.h"
+#include "hazard_pointers.hpp"
+#include "snapshot.hpp"
+
+//Lock-free set (Harris-Michael list with hazard pointers)
+template <class T>
+class SetLockFree final : public SetBase<T, SetLockFree<T> >
+{
+public:
+  SetLockFree()
+  {
+    if (!error_handler) //Error handler needs to be specified before
+      error_handler(g_msg_err_error_handler);
+    //Initialize head of the list (the list is terminated by nullptr)
+    head = new Node(0);
+    if (!head)
+      error_handler(g_msg_err_node_create);
+  }
+
+  //Build the set of the range elements: the range is sorted once and the nodes are linked in one pass
+  //without CAS (nobody else can see the set before the constructor returns)
+  SetLockFree(const T* begin, const T* end) : SetLockFree()
+  {
+    std::vector<BatchEntry> batch;
+    Set<T>::sort_batch(begin, end, batch);
+    Node* last = head;
+    size_t added = 0;
+    for (size_t i = 0; i < batch.size(); ++i)
+    {
+      if (i > 0 && batch[i - 1].first == batch[i].first)
+        continue; //Duplicate in the range
+      Node* to_insert = new Node(begin[batch[i].second]);
+      if (!to_insert)
+        error_handler(g_msg_err_node_create);
+      last->next.store(make_link(to_insert, false), std::memory_order_relaxed);
+      last = to_insert;
+      ++added;
+    }
+    stats.add(SetStats::ALLOCATIONS, added);
+  }
+
+  ~SetLockFree()
+  {
+    //Delete all elements from the list
+    for (Node *current = head, *next = nullptr; current != nullptr; current = next)
+    {
+      next = get_node(current->next.load(std::memory_order_relaxed));
+      delete current;
+    }
+  }
+
+  bool add(const T& item)
+  {
+    return insert_item(item);
+  }
+
+  bool add(T&& item)
+  {
+    return insert_item(std::move(item));
+  }
+
+  bool remove(const T& item)
+  {
+    SnapshotGate::WriteScope write(gate);
+    size_t key = generate_hash(item);
+    typename Domain::Guard guard(domain);
+    while (true)
+    {
+      Position position;
+      if (!find(guard, key, position))
+        return false;
+      //Mark the next pointer of the node (logical removal)
+      uintptr_t next = position.current->next.load();
+      if (is_marked(next) || !position.current->next.compare_exchange_strong(next, next | MARK_BIT))
+      {
+        stats.add(SetStats::RETRIES);
+        continue;
+      }
+      //Try to unlink the node, if it fails then find(...) will unlink it
+      uintptr_t expected = make_link(position.current, false);
+      if (position.previous->compare_exchange_strong(expected, next))
+      {
+        guard.retire(position.current);
+        stats.add(SetStats::RETIREMENTS);
+      }
+      else
+        find(guard, key, position);
+      return true;
+    }
+  }
+
+  bool contains(const T& item)
+  {
+    size_t key = generate_hash(item);
+    typename Domain::Guard guard(domain);
+    Position position;
+    return find(guard, key, position);
+  }
+
+  //Add elements of the range in one traversal: every search resumes from the position of the previous key
+  //(number of added elements)
+  size_t add_all(const T* begin, const T* end)
+  {
+    SnapshotGate::WriteScope write(gate);
+    std::vector<BatchEntry> batch;
+    Set<T>::sort_batch(begin, end, batch);
+    typename Domain::Guard guard(domain);
+    size_t added = 0;
+    Position position = { &head->next, nullptr };
+    for (size_t i = 0; i < batch.size(); ++i)
+    {
+      size_t key = batch[i].first;
+      if (i > 0 && batch[i - 1].first == key)
+        continue; //Duplicate in the batch
+      Node* to_insert = nullptr;
+      while (!find(guard, key, position, position.previous))
+      {
+        if (!to_insert)
+        {
+          to_insert = new Node(begin[batch[i].second]);
+          if (!to_insert)
+            error_handler(g_msg_err_node_create);
+          stats.add(SetStats::ALLOCATIONS);
+        }
+        to_insert->next.store(make_link(position.current, false), std::memory_order_relaxed);
+        uintptr_t expected = make_link(position.current, false);
+        if (position.previous->compare_exchange_strong(expected, make_link(to_insert, false)))
+        {
+          //The next search passes the new node from the same link
+          to_insert = nullptr;
+          ++added;
+          break;
+        }
+        stats.add(SetStats::RETRIES);
+      }
+      delete to_insert;
+    }
+    return added;
+  }
+
+  //Remove elements of the range in one traversal as in add_all(...) (number of deleted elements)
+  size_t remove_all(const T* begin, const T* end)
+  {
+    SnapshotGate::WriteScope write(gate);
+    std::vector<BatchEntry> batch;
+    Set<T>::sort_batch(begin, end, batch);
+    typename Domain::Guard guard(domain);
+    size_t removed = 0;
+    Position position = { &head->next, nullptr };
+    for (size_t i = 0; i < batch.size(); ++i)
+    {
+      size_t key = batch[i].first;
+      while (find(guard, key, position, position.previous))
+      {
+        //Mark and unlink the node as in remove(...)
+        uintptr_t next = position.current->next.load();
+        if (is_marked(next) || !position.current->next.compare_exchange_strong(next, next | MARK_BIT))
+        {
+          stats.add(SetStats::RETRIES);
+          continue;
+        }
+        uintptr_t expected = make_link(position.current, false);
+        if (position.previous->compare_exchange_strong(expected, next))
+        {
+          guard.retire(position.current);
+          stats.add(SetStats::RETIREMENTS);
+        }
+        else
+          find(guard, key, position, position.previous);
+        ++removed;
+        break;
+      }
+    }
+    return removed;
+  }
+
+  //Check elements of the range in one traversal as in add_all(...)
+  void contains_all(const T* begin, const T* end, bool* out)
+  {
+    std::vector<BatchEntry> batch;
+    Set<T>::sort_batch(begin, end, batch);
+    typename Domain::Guard guard(domain);
+    Position position = { &head->next, nullptr };
+    for (size_t i = 0; i < batch.size(); ++i)
+      out[batch[i].second] = find(guard, batch[i].first, position, position.previous);
+  }
+
+  //Remove all elements taking the first node every time: it is marked and unlinked as in remove(...),
+  //without searching for a key, so the sweep is linear in the number of nodes
+  void clear()
+  {
+    SnapshotGate::WriteScope write(gate);
+    typename Domain::Guard guard(domain);
+    size_t removed = 0;
+    Position position;
+    //The first node is the position of the smallest key
+    while (find(guard, 0, position) || position.current)
+    {
+      uintptr_t next = position.current->next.load();
+      if (is_marked(next) || !position.current->next.compare_exchange_strong(next, next | MARK_BIT))
+      {
+        stats.add(SetStats::RETRIES);
+        continue;
+      }
+      uintptr_t expected = make_link(position.current, false);
+      if (position.previous->compare_exchange_strong(expected, next))
+      {
+        guard.retire(position.current);
+        ++removed;
+      }
+    }
+    stats.add(SetStats::RETIREMENTS, removed);
+  }
+
+protected:
+  //Copy elements with keys in [lo_key, hi_key] as of one point in time (see snapshot.hpp)
+  void collect(size_t lo_key, size_t hi_key, std::vector<T>& out)
+  {
+    Collector collector = { &domain, head, lo_key, hi_key, &out };
+    gate.read(collector);
+  }
+
+public:
+  SetStatistics statistics() const
+  {
+    return stats.get();
+  }
+
+  void reset_statistics()
+  {
+    stats.reset();
+  }
+
+  static void set_error_handler(void(*handler)(const char*))
+  {
+    error_handler = handler;
+  }
+
+private:
+  typedef typename Set<T>::BatchEntry BatchEntry;
+
+  class Node
+  {
+  public:
+    template <class U>
+    Node(U&& init_value) : item(std::forward<U>(init_value)), key(std::hash<T>()(item)), next(0) {}
+
+    T item; //Raw data
+    size_t key; //Data key (hash)
+    std::atomic<uintptr_t> next; //Pointer to the next node with a deletion mark in the lowest bit
+  };
+
+  typedef HazardDomain<Node, 3> Domain;
+
+  //Hazard pointers indices
+  enum { HP_NEXT = 0, HP_CURRENT = 1, HP_PREVIOUS = 2 };
+
+  static const uintptr_t MARK_BIT = 1;
+
+  //Key position in the list
+  struct Position
+  {
+    std::atomic<uintptr_t>* previous; //Link that points to current
+    Node* current; //First node with a key not less than the searched one
+  };
+
+  Node* head; //Head of the list
+  SnapshotGate gate; //Consistent snapshots against concurrent modifications
+  Domain domain; //Removed nodes reclamation
+  SetStats stats; //Contention statistics (see set_stats.hpp)
+  static void(*error_handler)(const char*); //Fatal errors handler
+
+  static Node* get_node(uintptr_t link)
+  {
+    return reinterpret_cast<Node*>(link & ~MARK_BIT);
+  }
+
+  static bool is_marked(uintptr_t link)
+  {
+    return (link & MARK_BIT) != 0;
+  }
+
+  static uintptr_t make_link(Node* node, bool marked)
+  {
+    return reinterpret_cast<uintptr_t>(node) | (marked ? MARK_BIT : 0);
+  }
+
+  //Find the key position unlinking marked nodes on the way (true if the key is in the list)
+  //The search may resume from the link of a position found before with the same guard for a smaller key: its
+  //node is still protected, and if it has been removed meanwhile the link is marked and the search restarts
+  //from the head.
+  bool find(typename Domain::Guard& guard, size_t key, Position& position, std::atomic<uintptr_t>* start = nullptr)
+  {
+    size_t steps = 0;
+    while (true)
+    {
+      std::atomic<uintptr_t>* previous = start ? start : &head->next;
+      start = nullptr;
+      Node* current = get_node(previous->load());
+      guard.protect(HP_CURRENT, current);
+      if (previous->load() != make_link(current, false))
+        continue;
+
+      bool restart = false;
+      while (!restart)
+      {
+        if (!current)
+        {
+          position.previous = previous;
+          position.current = nullptr;
+          stats.traversal(steps);
+          return false;
+        }
+        uintptr_t next = current->next.load();
+        guard.protect(HP_NEXT, get_node(next));
+        //Check that current is still linked to previous and next is still linked to current
+        if (current->next.load() != next || previous->load() != make_link(current, false))
+        {
+          stats.add(SetStats::RETRIES);
+          restart = true;
+          continue;
+        }
+
+        if (!is_marked(next))
+        {
+          if (current->key >= key)
+          {
+            position.previous = previous;
+            position.current = current;
+            stats.traversal(steps);
+            return current->key == key;
+          }
+          previous = &current->next;
+          guard.protect(HP_PREVIOUS, current);
+        }
+        else
+        {
+          //Help to unlink a removed node
+          uintptr_t expected = make_link(current, false);
+          if (!previous->compare_exchange_strong(expected, make_link(get_node(next), false)))
+          {
+            stats.add(SetStats::RETRIES);
+            restart = true;
+            continue;
+          }
+          guard.retire(current);
+          stats.add(SetStats::RETIREMENTS);
+        }
+        current = get_node(next);
+        guard.protect(HP_CURRENT, current);
+        ++steps;
+      }
+    }
+  }
+
+  //Hazard-protected walk over the list for the snapshot gate (fails on a node that is being removed)
+  struct Collector
+  {
+    Domain* domain; //Hazard pointers domain
+    Node* start; //Node to start after
+    size_t lo_key, hi_key; //Keys range
+    std::vector<T>* out; //Collected elements
+
+    bool operator()()
+    {
+      out->clear();
+      typename Domain::Guard guard(*domain);
+      std::atomic<uintptr_t>* previous = &start->next;
+      Node* current = get_node(previous->load());
+      guard.protect(HP_CURRENT, current);
+      if (previous->load() != make_link(current, false))
+        return false;
+      while (current && current->key <= hi_key)
+      {
+        uintptr_t next = current->next.load();
+        guard.protect(HP_NEXT, get_node(next));
+        if (is_marked(next) || current->next.load() != next || previous->load() != make_link(current, false))
+          return false;
+        if (current->key >= lo_key)
+          out->push_back(current->item);
+        previous = &current->next;
+        guard.protect(HP_PREVIOUS, current);
+        current = get_node(next);
+        guard.protect(HP_CURRENT, current);
+      }
+      return true;
+    }
+  };
+
+  //Add an element copied or moved into the new node
+  template <class U>
+  bool insert_item(U&& item)
+  {
+    SnapshotGate::WriteScope write(gate);
+    size_t key = generate_hash(item);
+    typename Domain::Guard guard(domain);
+    Node* to_insert = nullptr;
+    while (true)
+    {
+      Position position;
+      if (find(guard, key, position))
+      {
+        if (to_insert)
+        {
+          Set<T>::give_back(std::forward<U>(item), to_insert->item);
+          delete to_insert;
+        }
+        return false;
+      }
+      //Link a new node between position.previous and position.current
+      if (!to_insert)
+      {
+        to_insert = new Node(std::forward<U>(item));
+        if (!to_insert)
+          error_handler(g_msg_err_node_create);
+        stats.add(SetStats::ALLOCATIONS);
+      }
+      to_insert->next.store(make_link(position.current, false), std::memory_order_relaxed);
+      uintptr_t expected = make_link(position.current, false);
+      if (position.previous->compare_exchange_strong(expected, make_link(to_insert, false)))
+        return true;
+      stats.add(SetStats::RETRIES);
+    }
+  }
+
+  size_t generate_hash(const T& item)
+  {
+    return std::hash<T>()(item);
+  }
+};
+
+template <class T>
+void(*SetLockFree<T>::error_handler)(const char*) = nullptr;
+
+#endif
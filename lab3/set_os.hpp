@@ -6,10 +6,15 @@
 #include <bits/stdc++.h>
 
 #include "set.h"
+#include "epoch.hpp"
+#include "snapshot.hpp"
+#include "locks.hpp"
+#include "node_alloc.hpp"
 
-//Optimistic synchronization set
-template <class T>
-class SetOS : public Set<T>
+//Optimistic synchronization set (Lock is a lock policy from locks.hpp, Alloc is a node allocation policy from node_alloc.hpp,
+//Stats are statistics counters from set_stats.hpp)
+template <class T, class Lock = LockMutex, class Alloc = AllocDefault, class Compare = std::less<T>, class Stats = SetStats>
+class SetOS final : public SetBase<T, SetOS<T, Lock, Alloc, Compare, Stats> >
 {
 public:
   SetOS()
@@ -17,14 +22,39 @@ public:
     if (!error_handler) //Error handler needs to be specified before
       error_handler(g_msg_err_error_handler);
     //Initialize head of the list and it's next element
-    head = new Node(0);
+    head = new Node(Node::RANK_HEAD);
     if (!head)
       error_handler(g_msg_err_node_create);
-    head->next = new Node(INT_MAX);
+    head->next = new Node(Node::RANK_TAIL);
     if (!head->next)
       error_handler(g_msg_err_node_create);
   }
 
+  //Build the set of the range elements: the range is sorted once and the nodes are linked in one pass without
+  //locking (nobody else can see the set before the constructor returns)
+  SetOS(const T* begin, const T* end) : SetOS()
+  {
+    std::vector<BatchEntry> batch;
+    Set<T>::sort_batch(begin, end, batch, Compare());
+    Node* last = head;
+    size_t added = 0;
+    for (size_t i = 0; i < batch.size(); ++i)
+    {
+      size_t key = batch[i].first;
+      const T& item = begin[batch[i].second];
+      if (i > 0 && batch[i - 1].first == key && Node::equivalent(begin[batch[i - 1].second], item))
+        continue; //Duplicate in the range
+      Node* to_insert = new Node(key, item);
+      if (!to_insert)
+        error_handler(g_msg_err_node_create);
+      to_insert->next = last->next;
+      last->next = to_insert;
+      last = to_insert;
+      ++added;
+    }
+    stats.add(Stats::ALLOCATIONS, added);
+  }
+
   ~SetOS()
   {
     //Delete all elements from the list
@@ -37,112 +67,258 @@ public:
 
   bool add(const T& item)
   {
+    return insert_item(item);
+  }
+
+  bool add(T&& item)
+  {
+    return insert_item(std::move(item));
+  }
+
+  bool remove(const T& item)
+  {
+    SnapshotGate::WriteScope write(gate);
     size_t key = generate_hash(item);
+    //Nodes met during the unlocked traversal are not freed until the guard is destroyed
+    EpochDomain::Guard guard(reclamation);
     while (true)
     {
       //Update _current and _previous so we're in the key position
       Node* _previous = head;
       Node* _current = head->next;
-      while (_current->key < key)
+      size_t steps = 0;
+      while (_current->before(key, item))
       {
+        ++steps;
         _previous = _current;
         _current = _current->next;
       }
+      stats.traversal(steps);
 
-      //Lock the nodes under the position
-      _previous->lock();
-      _current->lock();
+      _previous->lock(stats);
+      _current->lock(stats);
       //Check that _previous points to _current and is reachable from the head
       if (validate(_previous, _current))
       {
-        if (_current->key == key)
+        if (_current->holds(key, item))
         {
+          //Delete if found
+          _previous->next = _current->next;
           _previous->unlock();
           _current->unlock();
-          return false;
+          guard.retire(_current, delete_node);
+          stats.add(Stats::RETIREMENTS);
+          return true;
         }
         else
         {
-          //Insert a new node
-          Node* to_insert = new Node(item);
-          if (!to_insert)
-            error_handler(g_msg_err_node_create);
-          to_insert->next = _current;
-          _previous->next = to_insert;
           _previous->unlock();
           _current->unlock();
-          return true;
+          return false;
         }
       }
       _previous->unlock();
       _current->unlock();
+      stats.add(Stats::RETRIES);
     }
   }
 
-  bool remove(const T& item)
+  bool contains(const T& item)
   {
     size_t key = generate_hash(item);
+    //Nodes met during the unlocked traversal are not freed until the guard is destroyed
+    EpochDomain::Guard guard(reclamation);
     while (true)
     {
-      //Update _current and _previous so we're in the key position
       Node* _previous = head;
       Node* _current = head->next;
-      while (_current->key < key)
+      size_t steps = 0;
+      while (_current->before(key, item))
       {
+        ++steps;
         _previous = _current;
         _current = _current->next;
       }
+      stats.traversal(steps);
 
-      _previous->lock();
-      _current->lock();
-      //Check that _previous points to _current and is reachable from the head
+      _previous->lock(stats);
+      _current->lock(stats);
       if (validate(_previous, _current))
       {
-        if (_current->key == key)
-        {
-          //Delete if found
-          _previous->next = _current->next;
-          delete _current;
-          _previous->unlock();
-          _current->unlock();
-          return true;
-        }
-        else
-        {
-          _previous->unlock();
-          _current->unlock();
-          return false;
-        }
+        _previous->unlock();
+        _current->unlock();
+        return _current->holds(key, item);
       }
       _previous->unlock();
       _current->unlock();
+      stats.add(Stats::RETRIES);
     }
   }
 
-  bool contains(const T& item)
+  //Add elements of the range in one hand-over-hand traversal (number of added elements)
+  //Every modification still happens with both neighbour nodes locked, so optimistic operations
+  //validate against the same invariant
+  size_t add_all(const T* begin, const T* end)
   {
-    size_t key = generate_hash(item);
-    while (true)
+    SnapshotGate::WriteScope write(gate);
+    std::vector<BatchEntry> batch;
+    Set<T>::sort_batch(begin, end, batch, Compare());
+    size_t added = 0;
+    head->lock(stats);
+    Node* _previous = head;
+    Node* _current = head->next;
+    _current->lock(stats);
+    size_t steps = 0;
+    for (size_t i = 0; i < batch.size(); ++i)
     {
-      Node* _previous = head;
-      Node* _current = head->next;
-      while (_current->key < key)
+      size_t key = batch[i].first;
+      const T& item = begin[batch[i].second];
+      if (i > 0 && batch[i - 1].first == key && Node::equivalent(begin[batch[i - 1].second], item))
+        continue; //Duplicate in the batch
+      while (_current->before(key, item))
       {
+        ++steps;
+        _previous->unlock();
         _previous = _current;
         _current = _current->next;
+        _current->lock(stats);
       }
+      if (_current->holds(key, item))
+        continue;
 
-      _previous->lock();
-      _current->lock();
-      if (validate(_previous, _current))
+      //Insert a new node locked, it becomes _previous for the rest of the batch
+      Node* to_insert = new Node(key, item);
+      if (!to_insert)
+        error_handler(g_msg_err_node_create);
+      stats.add(Stats::ALLOCATIONS);
+      to_insert->lock(stats);
+      to_insert->next = _current;
+      _previous->next = to_insert;
+      _previous->unlock();
+      _previous = to_insert;
+      ++added;
+    }
+    stats.traversal(steps);
+    _current->unlock();
+    _previous->unlock();
+    return added;
+  }
+
+  //Remove elements of the range in one hand-over-hand traversal (number of deleted elements)
+  size_t remove_all(const T* begin, const T* end)
+  {
+    SnapshotGate::WriteScope write(gate);
+    std::vector<BatchEntry> batch;
+    Set<T>::sort_batch(begin, end, batch, Compare());
+    EpochDomain::Guard guard(reclamation);
+    size_t removed = 0;
+    head->lock(stats);
+    Node* _previous = head;
+    Node* _current = head->next;
+    _current->lock(stats);
+    size_t steps = 0;
+    for (size_t i = 0; i < batch.size(); ++i)
+    {
+      size_t key = batch[i].first;
+      const T& item = begin[batch[i].second];
+      while (_current->before(key, item))
       {
+        ++steps;
         _previous->unlock();
-        _current->unlock();
-        return _current->key == key;
+        _previous = _current;
+        _current = _current->next;
+        _current->lock(stats);
       }
-      _previous->unlock();
+      if (!_current->holds(key, item))
+        continue;
+
+      //Unlink the node and move to its successor
+      _previous->next = _current->next;
       _current->unlock();
+      guard.retire(_current, delete_node);
+      stats.add(Stats::RETIREMENTS);
+      _current = _previous->next;
+      _current->lock(stats);
+      ++removed;
     }
+    stats.traversal(steps);
+    _current->unlock();
+    _previous->unlock();
+    return removed;
+  }
+
+  //Check elements of the range in one hand-over-hand traversal
+  void contains_all(const T* begin, const T* end, bool* out)
+  {
+    std::vector<BatchEntry> batch;
+    Set<T>::sort_batch(begin, end, batch, Compare());
+    head->lock(stats);
+    Node* _previous = head;
+    Node* _current = head->next;
+    _current->lock(stats);
+    size_t steps = 0;
+    for (size_t i = 0; i < batch.size(); ++i)
+    {
+      size_t key = batch[i].first;
+      const T& item = begin[batch[i].second];
+      while (_current->before(key, item))
+      {
+        ++steps;
+        _previous->unlock();
+        _previous = _current;
+        _current = _current->next;
+        _current->lock(stats);
+      }
+      out[batch[i].second] = _current->holds(key, item);
+    }
+    stats.traversal(steps);
+    _current->unlock();
+    _previous->unlock();
+  }
+
+  //Remove all elements in one sweep locking the nodes in the list order: the head stays locked, so unlinked
+  //nodes fail the validation of operations that reached them and are retired to the epoch domain
+  void clear()
+  {
+    SnapshotGate::WriteScope write(gate);
+    EpochDomain::Guard guard(reclamation);
+    head->lock(stats);
+    Node* _current = head->next;
+    _current->lock(stats);
+    size_t removed = 0;
+    while (_current->next != nullptr)
+    {
+      Node* next = _current->next;
+      next->lock(stats);
+      head->next = next;
+      _current->unlock();
+      guard.retire(_current, delete_node);
+      _current = next;
+      ++removed;
+    }
+    stats.add(Stats::RETIREMENTS, removed);
+    _current->unlock();
+    head->unlock();
+  }
+
+protected:
+  //Copy elements with keys in [lo_key, hi_key] as of one point in time (see snapshot.hpp)
+  void collect(size_t lo_key, size_t hi_key, std::vector<T>& out)
+  {
+    EpochDomain::Guard guard(reclamation);
+    Collector collector = { head, lo_key, hi_key, &out };
+    gate.read(collector);
+  }
+
+public:
+  SetStatistics statistics() const
+  {
+    return stats.get();
+  }
+
+  void reset_statistics()
+  {
+    stats.reset();
   }
 
   static void set_error_handler(void(*handler)(const char*))
@@ -151,41 +327,141 @@ public:
   }
 
 private:
+  typedef typename Set<T>::BatchEntry BatchEntry;
+
+  //Node of the list ordered by (key, element): elements with colliding keys are kept apart by the comparator,
+  //which has to agree with std::hash (equivalent elements have equal hashes)
   class Node
   {
   public:
-    Node(T init_value) : item(init_value), key(std::hash<T>()(init_value)), next(nullptr), mutex(PTHREAD_MUTEX_INITIALIZER) {}
+    enum Rank { RANK_HEAD, RANK_ITEM, RANK_TAIL };
+
+    //Sentinel: the head comes before and the tail after every element, whatever its key
+    explicit Node(Rank init_rank) : key(init_rank == RANK_HEAD ? 0 : SIZE_MAX), rank(init_rank), next(nullptr) {}
+
+    //Element node (the key is computed once by the caller)
+    template <class U>
+    Node(size_t init_key, U&& init_value) : key(init_key), rank(RANK_ITEM), next(nullptr)
+    {
+      new (&storage) T(std::forward<U>(init_value));
+    }
+
+    ~Node()
+    {
+      if (rank == RANK_ITEM)
+        item().~T();
+    }
 
-    T item; //Raw data
     size_t key; //Data key (hash)
+    Rank rank; //Sentinel or element
     Node* next; //Pointer to the next node
 
+    //Raw data (element nodes only)
+    T& item()
+    {
+      return *reinterpret_cast<T*>(&storage);
+    }
+
+    const T& item() const
+    {
+      return *reinterpret_cast<const T*>(&storage);
+    }
+
+    //Whether the node comes before the element (elements are compared only if the keys collide)
+    bool before(size_t other_key, const T& other) const
+    {
+      if (key != other_key)
+        return key < other_key;
+      if (rank != RANK_ITEM)
+        return rank == RANK_HEAD;
+      return Compare()(item(), other);
+    }
+
+    //Whether the node comes before another node
+    bool before(const Node* other) const
+    {
+      if (key != other->key)
+        return key < other->key;
+      if (rank != other->rank)
+        return rank < other->rank;
+      return rank == RANK_ITEM && Compare()(item(), other->item());
+    }
+
+    //Whether the node holds the element
+    bool holds(size_t other_key, const T& other) const
+    {
+      return key == other_key && rank == RANK_ITEM && equivalent(item(), other);
+    }
+
+    static bool equivalent(const T& left, const T& right)
+    {
+      return !Compare()(left, right) && !Compare()(right, left);
+    }
+
+    //Allocate nodes with the allocation policy (nullptr on failure)
+    static void* operator new(size_t) noexcept
+    {
+      return Alloc::template allocate<sizeof(Node)>();
+    }
+
+    static void operator delete(void* block)
+    {
+      Alloc::template deallocate<sizeof(Node)>(block);
+    }
+
                 //Lock the node
-    void lock()
+    void lock(Stats& stats)
     {
-      if (pthread_mutex_lock(&mutex) != 0)
+      typename Stats::LockTiming timing(stats);
+      if (!node_lock.lock())
         error_handler(g_msg_err_mutex_lock);
     }
 
     //Unlock the node
     void unlock()
     {
-      if (pthread_mutex_unlock(&mutex) != 0)
+      if (!node_lock.unlock())
         error_handler(g_msg_err_mutex_unlock);
     }
 
   private:
-    pthread_mutex_t mutex; //Mutex for a node lock
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type storage; //Element (constructed in element nodes only)
+    Lock node_lock; //Node lock (see locks.hpp for policies)
   };
 
   Node* head; //Head of the list
+  SnapshotGate gate; //Consistent snapshots against concurrent modifications
+  EpochDomain reclamation; //Removed nodes reclamation
+  Stats stats; //Contention statistics (see set_stats.hpp)
   static void(*error_handler)(const char*); //Fatal errors handler
 
+  //Unlocked walk over the list for the snapshot gate
+  struct Collector
+  {
+    Node* head; //Head of the list
+    size_t lo_key, hi_key; //Keys range
+    std::vector<T>* out; //Collected elements
+
+    bool operator()()
+    {
+      out->clear();
+      for (Node* current = head->next; current->next != nullptr && current->key <= hi_key; current = current->next)
+        if (current->key >= lo_key)
+          out->push_back(current->item());
+      return true;
+    }
+  };
+
+  static void delete_node(void* node)
+  {
+    delete static_cast<Node*>(node);
+  }
+
                                             //Validate that _previous points to _current and is reachable from the head
   bool validate(Node* previous, Node* current)
   {
     Node* node = head;
-    while (node->key <= previous->key)
+    while (!previous->before(node))
     {
       if (node == previous)
         return previous->next == current;
@@ -194,14 +470,68 @@ private:
     return false;
   }
 
+  //Add an element copied or moved into the new node
+  template <class U>
+  bool insert_item(U&& item)
+  {
+    SnapshotGate::WriteScope write(gate);
+    size_t key = generate_hash(item);
+    //Nodes met during the unlocked traversal are not freed until the guard is destroyed
+    EpochDomain::Guard guard(reclamation);
+    while (true)
+    {
+      //Update _current and _previous so we're in the key position
+      Node* _previous = head;
+      Node* _current = head->next;
+      size_t steps = 0;
+      while (_current->before(key, item))
+      {
+        ++steps;
+        _previous = _current;
+        _current = _current->next;
+      }
+      stats.traversal(steps);
+
+      //Lock the nodes under the position
+      _previous->lock(stats);
+      _current->lock(stats);
+      //Check that _previous points to _current and is reachable from the head
+      if (validate(_previous, _current))
+      {
+        if (_current->holds(key, item))
+        {
+          _previous->unlock();
+          _current->unlock();
+          return false;
+        }
+        else
+        {
+          //Insert a new node
+          Node* to_insert = new Node(key, std::forward<U>(item));
+          if (!to_insert)
+            error_handler(g_msg_err_node_create);
+          stats.add(Stats::ALLOCATIONS);
+          to_insert->next = _current;
+          _previous->next = to_insert;
+          _previous->unlock();
+          _current->unlock();
+          return true;
+        }
+      }
+      _previous->unlock();
+      _current->unlock();
+      stats.add(Stats::RETRIES);
+    }
+  }
+
   size_t generate_hash(const T& item)
   {
     return std::hash<T>()(item);
   }
 };
 
-template <class T>
-void(*SetOS<T>::error_handler)(const char*) = nullptr;
+template <class T, class Lock, class Alloc, class Compare, class Stats>
+void(*SetOS<T, Lock, Alloc, Compare, Stats>::error_handler)(const char*) = nullptr;
 
 #endif
 
@@ -0,0 +1,311 @@
+
+#ifndef SET_RCU_PLXWTA__
+#define SET_RCU_PLXWTA__
+
+#include <functional>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <bits/stdc++.h>
+
+#include "set.h"
+#include "epoch.hpp"
+#include "locks.hpp"
+
+//Read-copy-update set over an immutable sorted array (Lock is a lock policy from locks.hpp for writers)
+//Readers enter an epoch (a store and a fence, no read-modify-write), load the current version and binary-search it.
+//Writers serialize on one lock, copy the version with their changes, publish it with a release store and
+//retire the old one. Every replaced version is a whole copy of the set, so at most MAX_RETIRED_VERSIONS of them
+//wait: the writer that fills the list waits for a grace period (no reader can still hold them) and frees them.
+//Every version is a consistent state, so a snapshot is a copy of one version.
+template <class T, class Lock = LockMutex>
+class SetRCU final : public SetBase<T, SetRCU<T, Lock> >
+{
+public:
+  static const size_t MAX_RETIRED_VERSIONS = 8; //Replaced versions waiting for readers before a writer frees them
+
+  SetRCU()
+  {
+    if (!error_handler) //Error handler needs to be specified before
+      error_handler(g_msg_err_error_handler);
+    current.store(new Version(), std::memory_order_relaxed);
+    if (!current.load(std::memory_order_relaxed))
+      error_handler(g_msg_err_node_create);
+  }
+
+  ~SetRCU()
+  {
+    free_retired();
+    delete current.load(std::memory_order_relaxed);
+  }
+
+  bool add(const T& item)
+  {
+    return insert_item(item);
+  }
+
+  bool add(T&& item)
+  {
+    return insert_item(std::move(item));
+  }
+
+  bool remove(const T& item)
+  {
+    size_t key = generate_hash(item);
+    lock_writers();
+    const Version* version = current.load(std::memory_order_relaxed);
+    typename Entries::const_iterator position = find(version->entries, key);
+    if (position == version->entries.end() || position->key != key)
+    {
+      unlock_writers();
+      return false;
+    }
+
+    Version* next = new Version();
+    if (!next)
+      error_handler(g_msg_err_node_create);
+    next->entries.reserve(version->entries.size() - 1);
+    next->entries.insert(next->entries.end(), version->entries.begin(), position);
+    next->entries.insert(next->entries.end(), position + 1, version->entries.end());
+    publish(next);
+    unlock_writers();
+    return true;
+  }
+
+  //Wait-free check: no locks, no retries and no atomic read-modify-write
+  bool contains(const T& item)
+  {
+    size_t key = generate_hash(item);
+    EpochDomain::Guard guard(reclamation);
+    const Version* version = current.load(std::memory_order_acquire);
+    typename Entries::const_iterator position = find(version->entries, key);
+    return position != version->entries.end() && position->key == key;
+  }
+
+  //Add elements of the range with one new version merged from the current one and the sorted batch
+  size_t add_all(const T* begin, const T* end)
+  {
+    std::vector<BatchEntry> batch;
+    Set<T>::sort_batch(begin, end, batch);
+    lock_writers();
+    const Version* version = current.load(std::memory_order_relaxed);
+    Version* next = new Version();
+    if (!next)
+      error_handler(g_msg_err_node_create);
+    next->entries.reserve(version->entries.size() + batch.size());
+    typename Entries::const_iterator position = version->entries.begin();
+    size_t added = 0;
+    for (size_t i = 0; i < batch.size(); ++i)
+    {
+      size_t key = batch[i].first;
+      if (i > 0 && batch[i - 1].first == key)
+        continue; //Duplicate in the batch
+      typename Entries::const_iterator run_end = std::lower_bound(position, version->entries.end(), key, compare_entry_key);
+      next->entries.insert(next->entries.end(), position, run_end);
+      position = run_end;
+      if (position != version->entries.end() && position->key == key)
+        continue;
+      Entry entry = { key, begin[batch[i].second] };
+      next->entries.push_back(entry);
+      ++added;
+    }
+    next->entries.insert(next->entries.end(), position, version->entries.end());
+    if (added)
+      publish(next);
+    else
+      delete next;
+    unlock_writers();
+    return added;
+  }
+
+  //Remove elements of the range with one new version
+  size_t remove_all(const T* begin, const T* end)
+  {
+    std::vector<BatchEntry> batch;
+    Set<T>::sort_batch(begin, end, batch);
+    lock_writers();
+    const Version* version = current.load(std::memory_order_relaxed);
+    Version* next = new Version();
+    if (!next)
+      error_handler(g_msg_err_node_create);
+    next->entries.reserve(version->entries.size());
+    typename Entries::const_iterator position = version->entries.begin();
+    size_t removed = 0;
+    for (size_t i = 0; i < batch.size(); ++i)
+    {
+      typename Entries::const_iterator run_end = std::lower_bound(position, version->entries.end(), batch[i].first, compare_entry_key);
+      next->entries.insert(next->entries.end(), position, run_end);
+      position = run_end;
+      if (position != version->entries.end() && position->key == batch[i].first)
+      {
+        ++position;
+        ++removed;
+      }
+    }
+    next->entries.insert(next->entries.end(), position, version->entries.end());
+    if (removed)
+      publish(next);
+    else
+      delete next;
+    unlock_writers();
+    return removed;
+  }
+
+  //Check elements of the range in one version
+  void contains_all(const T* begin, const T* end, bool* out)
+  {
+    EpochDomain::Guard guard(reclamation);
+    const Version* version = current.load(std::memory_order_acquire);
+    for (const T* item = begin; item != end; ++item)
+    {
+      size_t key = generate_hash(*item);
+      typename Entries::const_iterator position = find(version->entries, key);
+      out[item - begin] = position != version->entries.end() && position->key == key;
+    }
+  }
+
+protected:
+  //Copy elements with keys in [lo_key, hi_key] of the current version (it never changes once published)
+  void collect(size_t lo_key, size_t hi_key, std::vector<T>& out)
+  {
+    EpochDomain::Guard guard(reclamation);
+    const Version* version = current.load(std::memory_order_acquire);
+    out.clear();
+    for (typename Entries::const_iterator entry = find(version->entries, lo_key); entry != version->entries.end() && entry->key <= hi_key; ++entry)
+      out.push_back(entry->item);
+  }
+
+public:
+  //Replaced versions not freed yet (never more than MAX_RETIRED_VERSIONS)
+  size_t retired_versions()
+  {
+    lock_writers();
+    size_t count = retired.size();
+    unlock_writers();
+    return count;
+  }
+
+  SetStatistics statistics() const
+  {
+    return stats.get();
+  }
+
+  void reset_statistics()
+  {
+    stats.reset();
+  }
+
+  static void set_error_handler(void(*handler)(const char*))
+  {
+    error_handler = handler;
+  }
+
+private:
+  typedef typename Set<T>::BatchEntry BatchEntry;
+
+  //Element of a version
+  struct Entry
+  {
+    size_t key; //Data key (hash)
+    T item; //Raw data
+  };
+
+  typedef std::vector<Entry> Entries;
+
+  //Immutable state of the set
+  struct Version
+  {
+    Entries entries; //Elements sorted by key
+  };
+
+  std::atomic<Version*> current; //Published version
+  std::vector<Version*> retired; //Replaced versions readers may still search (changed under the writers lock)
+  Lock writers; //Writers lock (see locks.hpp for policies)
+  EpochDomain reclamation; //Readers critical sections (writers wait for them to end before freeing versions)
+  SetStats stats; //Contention statistics (see set_stats.hpp)
+  static void(*error_handler)(const char*); //Fatal errors handler
+
+  static bool compare_entry_key(const Entry& entry, size_t key)
+  {
+    return entry.key < key;
+  }
+
+  static typename Entries::const_iterator find(const Entries& entries, size_t key)
+  {
+    return std::lower_bound(entries.begin(), entries.end(), key, compare_entry_key);
+  }
+
+  void lock_writers()
+  {
+    SetStats::LockTiming timing(stats);
+    if (!writers.lock())
+      error_handler(g_msg_err_mutex_lock);
+  }
+
+  void unlock_writers()
+  {
+    if (!writers.unlock())
+      error_handler(g_msg_err_mutex_unlock);
+  }
+
+  //Replace the current version (called with the writers lock held)
+  //Writers are serialized anyway, so the one that fills the retired list waits for the readers itself.
+  void publish(Version* next)
+  {
+    Version* previous = current.load(std::memory_order_relaxed);
+    current.store(next, std::memory_order_release);
+    retired.push_back(previous);
+    stats.add(SetStats::ALLOCATIONS);
+    stats.add(SetStats::RETIREMENTS);
+    if (retired.size() >= MAX_RETIRED_VERSIONS)
+    {
+      reclamation.synchronize();
+      free_retired();
+    }
+  }
+
+  //Free the replaced versions (no reader may hold them)
+  void free_retired()
+  {
+    for (size_t i = 0; i < retired.size(); ++i)
+      delete retired[i];
+    retired.clear();
+  }
+
+  //Add an element copied or moved into the new version
+  template <class U>
+  bool insert_item(U&& item)
+  {
+    size_t key = generate_hash(item);
+    lock_writers();
+    const Version* version = current.load(std::memory_order_relaxed);
+    typename Entries::const_iterator position = find(version->entries, key);
+    if (position != version->entries.end() && position->key == key)
+    {
+      unlock_writers();
+      return false;
+    }
+
+    Version* next = new Version();
+    if (!next)
+      error_handler(g_msg_err_node_create);
+    next->entries.reserve(version->entries.size() + 1);
+    next->entries.insert(next->entries.end(), version->entries.begin(), position);
+    Entry entry = { key, std::forward<U>(item) };
+    next->entries.push_back(std::move(entry));
+    next->entries.insert(next->entries.end(), position, version->entries.end());
+    publish(next);
+    unlock_writers();
+    return true;
+  }
+
+  size_t generate_hash(const T& item)
+  {
+    return std::hash<T>()(item);
+  }
+};
+
+template <class T, class Lock>
+void(*SetRCU<T, Lock>::error_handler)(const char*) = nullptr;
+
+#endif
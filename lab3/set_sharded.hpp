@@ -0,0 +1,303 @@
+
+#ifndef SET_SHARDED_MZTQLD__
+#define SET_SHARDED_MZTQLD__
+
+#include <functional>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <thread>
+#include <algorithm>
+#include <pthread.h>
+#include <sched.h>
+#include <bits/stdc++.h>
+
+#include "set.h"
+#include "snapshot.hpp"
+
+//Sharded set: the keys are split between Shards independent Inner sets (Inner is any set of T, e.g. SetFGS<T>)
+//A key goes to the shard picked by the top bits of its Fibonacci hash, so threads working on different
+//keys start from different heads and every list is Shards times shorter. Shard headers are cache-line padded.
+//With NUMA placement every shard is created by a thread pinned to the CPUs of a NUMA node in turn, so the
+//memory the shard starts with is first touched on that node.
+template <class Inner, class T = typename Inner::value_type, size_t Shards = 16>
+class SetSharded final : public SetBase<T, SetSharded<Inner, T, Shards> >
+{
+public:
+  static_assert(Shards >= 2 && (Shards & (Shards - 1)) == 0, "Shards must be a power of 2");
+  static const size_t CACHE_LINE = 64; //Padding between shard headers
+
+  SetSharded(bool numa_placement = false)
+  {
+    if (!error_handler) //Error handler needs to be specified before
+      error_handler(g_msg_err_error_handler);
+    std::vector<std::vector<int> > nodes;
+    if (numa_placement)
+      nodes = numa_nodes();
+    for (size_t i = 0; i < Shards; ++i)
+    {
+      if (nodes.size() > 1)
+      {
+        std::thread creator(create_shard_on, &shards[i], &nodes[i % nodes.size()]);
+        creator.join();
+      }
+      else
+        shards[i].set = new Inner();
+      if (!shards[i].set)
+        error_handler(g_msg_err_node_create);
+    }
+  }
+
+  ~SetSharded()
+  {
+    for (size_t i = 0; i < Shards; ++i)
+      delete shards[i].set;
+  }
+
+  bool add(const T& item)
+  {
+    SnapshotGate::WriteScope write(gate);
+    return shard(item)->add(item);
+  }
+
+  bool add(T&& item)
+  {
+    SnapshotGate::WriteScope write(gate);
+    Inner* set = shard(item);
+    return set->add(std::move(item));
+  }
+
+  bool remove(const T& item)
+  {
+    SnapshotGate::WriteScope write(gate);
+    return shard(item)->remove(item);
+  }
+
+  bool contains(const T& item)
+  {
+    return shard(item)->contains(item);
+  }
+
+  //Batches are split by shard and every part goes to the batch operation of its shard
+  size_t add_all(const T* begin, const T* end)
+  {
+    SnapshotGate::WriteScope write(gate);
+    Partition partition;
+    split_batch(begin, end, partition);
+    size_t added = 0;
+    for (size_t i = 0; i < Shards; ++i)
+      if (partition.bounds[i] != partition.bounds[i + 1])
+        added += shards[i].set->add_all(partition.part(i), partition.part(i + 1));
+    return added;
+  }
+
+  size_t remove_all(const T* begin, const T* end)
+  {
+    SnapshotGate::WriteScope write(gate);
+    Partition partition;
+    split_batch(begin, end, partition);
+    size_t removed = 0;
+    for (size_t i = 0; i < Shards; ++i)
+      if (partition.bounds[i] != partition.bounds[i + 1])
+        removed += shards[i].set->remove_all(partition.part(i), partition.part(i + 1));
+    return removed;
+  }
+
+  void contains_all(const T* begin, const T* end, bool* out)
+  {
+    Partition partition;
+    split_batch(begin, end, partition);
+    bool* found = new bool[end - begin];
+    for (size_t i = 0; i < Shards; ++i)
+      if (partition.bounds[i] != partition.bounds[i + 1])
+        shards[i].set->contains_all(partition.part(i), partition.part(i + 1), found + partition.bounds[i]);
+    for (size_t i = 0; i < partition.indices.size(); ++i)
+      out[partition.indices[i]] = found[i];
+    delete[] found;
+  }
+
+  //Remove all elements shard by shard (available when the inner set has clear())
+  void clear()
+  {
+    SnapshotGate::WriteScope write(gate);
+    for (size_t i = 0; i < Shards; ++i)
+      shards[i].set->clear();
+  }
+
+protected:
+  //Copy elements with keys in [lo_key, hi_key] of all shards as of one point in time (see snapshot.hpp)
+  void collect(size_t lo_key, size_t hi_key, std::vector<T>& out)
+  {
+    Collector collector = { shards, lo_key, hi_key, &out };
+    gate.read(collector);
+  }
+
+public:
+  SetStatistics statistics() const
+  {
+    SetStatistics statistics;
+    for (size_t i = 0; i < Shards; ++i)
+      statistics.add(shards[i].set->statistics());
+    return statistics;
+  }
+
+  void reset_statistics()
+  {
+    for (size_t i = 0; i < Shards; ++i)
+      shards[i].set->reset_statistics();
+  }
+
+  static void set_error_handler(void(*handler)(const char*))
+  {
+    error_handler = handler;
+    Inner::set_error_handler(handler);
+  }
+
+private:
+  //Shard header
+  struct Shard
+  {
+    Shard() : set(nullptr) {}
+
+    Inner* set; //Set of the shard
+    char padding[CACHE_LINE]; //Keep headers of different shards in different cache lines
+  };
+
+  //Batch elements grouped by shard: elements of shard i are items[bounds[i]] ... items[bounds[i + 1] - 1]
+  struct Partition
+  {
+    std::vector<T> items; //Elements in shard order
+    std::vector<size_t> indices; //Index in the batch of every element
+    size_t bounds[Shards + 1]; //Start of every shard's part
+
+    const T* part(size_t shard) const
+    {
+      return items.data() + bounds[shard];
+    }
+  };
+
+  //Order of the elements of a set
+  struct KeyOrder
+  {
+    bool operator()(const T& left, const T& right) const
+    {
+      return std::hash<T>()(left) < std::hash<T>()(right);
+    }
+  };
+
+  //Walk over the shards for the snapshot gate: the outer gate validates the shards together
+  struct Collector
+  {
+    Shard* shards; //Shards of the set
+    size_t lo_key, hi_key; //Keys range
+    std::vector<T>* out; //Collected elements
+
+    bool operator()()
+    {
+      out->clear();
+      std::vector<T> part;
+      for (size_t i = 0; i < Shards; ++i)
+      {
+        Set<T>::collect_from(*shards[i].set, lo_key, hi_key, part);
+        size_t middle = out->size();
+        out->insert(out->end(), part.begin(), part.end());
+        std::inplace_merge(out->begin(), out->begin() + middle, out->end(), KeyOrder());
+      }
+      return true;
+    }
+  };
+
+  Shard shards[Shards]; //Shards of the set
+  SnapshotGate gate; //Consistent snapshots against concurrent modifications of all shards
+  static void(*error_handler)(const char*); //Fatal errors handler
+
+  Inner* shard(const T& item)
+  {
+    return shards[shard_index(std::hash<T>()(item))].set;
+  }
+
+  //Fibonacci hashing: the top bits of the product depend on every bit of the key, so keys that differ
+  //only in low bits (like small integers hashed by identity) are spread over all shards
+  static size_t shard_index(size_t key)
+  {
+    static const unsigned SHIFT = 64 - __builtin_ctzll(Shards);
+    return (size_t)(((uint64_t)key * 0x9E3779B97F4A7C15ULL) >> SHIFT);
+  }
+
+  //Group the elements of a batch by shard (counting sort keeps the batch order inside a shard)
+  void split_batch(const T* begin, const T* end, Partition& partition)
+  {
+    size_t size = end - begin;
+    std::vector<size_t> owners(size);
+    std::fill(partition.bounds, partition.bounds + Shards + 1, 0);
+    for (size_t i = 0; i < size; ++i)
+    {
+      owners[i] = shard_index(std::hash<T>()(begin[i]));
+      ++partition.bounds[owners[i] + 1];
+    }
+    for (size_t i = 0; i < Shards; ++i)
+      partition.bounds[i + 1] += partition.bounds[i];
+    std::vector<size_t> next(partition.bounds, partition.bounds + Shards);
+    partition.indices.resize(size);
+    for (size_t i = 0; i < size; ++i)
+      partition.indices[next[owners[i]]++] = i;
+    partition.items.clear();
+    partition.items.reserve(size);
+    for (size_t i = 0; i < size; ++i)
+      partition.items.push_back(begin[partition.indices[i]]);
+  }
+
+  //Create the set of a shard on a thread pinned to the CPUs of a NUMA node
+  static void create_shard_on(Shard* shard, const std::vector<int>* cpus)
+  {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (size_t i = 0; i < cpus->size(); ++i)
+      CPU_SET((*cpus)[i], &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    shard->set = new Inner();
+  }
+
+  //CPUs of every NUMA node (empty if the topology is not known)
+  static std::vector<std::vector<int> > numa_nodes()
+  {
+    std::vector<std::vector<int> > nodes;
+    std::vector<int> online = read_list("/sys/devices/system/node/online");
+    for (size_t i = 0; i < online.size(); ++i)
+    {
+      std::vector<int> cpus = read_list("/sys/devices/system/node/node" + std::to_string(online[i]) + "/cpulist");
+      if (!cpus.empty())
+        nodes.push_back(cpus);
+    }
+    return nodes;
+  }
+
+  //Read a sysfs list like "0-3,8,10-11"
+  static std::vector<int> read_list(const std::string& path)
+  {
+    std::vector<int> list;
+    std::ifstream file(path.c_str());
+    std::string line;
+    if (!std::getline(file, line))
+      return list;
+    for (size_t position = 0; position < line.size();)
+    {
+      size_t comma = line.find(',', position);
+      if (comma == std::string::npos)
+        comma = line.size();
+      std::string range = line.substr(position, comma - position);
+      size_t dash = range.find('-');
+      int first = atoi(range.c_str());
+      int last = dash == std::string::npos ? first : atoi(range.c_str() + dash + 1);
+      for (int value = first; value <= last; ++value)
+        list.push_back(value);
+      position = comma + 1;
+    }
+    return list;
+  }
+};
+
+template <class Inner, class T, size_t Shards>
+void(*SetSharded<Inner, T, Shards>::error_handler)(const char*) = nullptr;
+
+#endif
@@ -0,0 +1,358 @@
+
+#ifndef SET_SKIPLIST_JXQWHB__
+#define SET_SKIPLIST_JXQWHB__
+
+#include <functional>
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <bits/stdc++.h>
+
+#include "set.h"
+#include "epoch.hpp"
+#include "snapshot.hpp"
+
+//Lock-free skip list set (sorted by key, every level is linked with CAS on marked next pointers)
+template <class T>
+class SetSkipList final : public SetBase<T, SetSkipList<T> >
+{
+public:
+  static const int MAX_LEVEL = 32; //Maximum number of levels
+
+  SetSkipList()
+  {
+    if (!error_handler) //Error handler needs to be specified before
+      error_handler(g_msg_err_error_handler);
+    //Initialize head of the list (every level is terminated by nullptr)
+    head = new Node(0, MAX_LEVEL - 1);
+    if (!head)
+      error_handler(g_msg_err_node_create);
+  }
+
+  ~SetSkipList()
+  {
+    //Delete all elements from the bottom level
+    for (Node *current = head, *next = nullptr; current != nullptr; current = next)
+    {
+      next = get_node(current->next[0].load(std::memory_order_relaxed));
+      delete current;
+    }
+  }
+
+  bool add(const T& item)
+  {
+    return insert_item(item);
+  }
+
+  bool add(T&& item)
+  {
+    return insert_item(std::move(item));
+  }
+
+  bool remove(const T& item)
+  {
+    SnapshotGate::WriteScope write(gate);
+    size_t key = generate_hash(item);
+    Node* preds[MAX_LEVEL];
+    Node* succs[MAX_LEVEL];
+    EpochDomain::Guard guard(reclamation);
+    if (!find(key, preds, succs))
+      return false;
+
+    //Mark upper levels from the top, then the bottom one (logical removal)
+    Node* to_remove = succs[0];
+    for (int level = to_remove->top_level; level >= 1; --level)
+    {
+      uintptr_t next = to_remove->next[level].load();
+      while (!is_marked(next))
+        to_remove->next[level].compare_exchange_weak(next, next | MARK_BIT);
+    }
+    uintptr_t next = to_remove->next[0].load();
+    while (!is_marked(next))
+    {
+      if (to_remove->next[0].compare_exchange_strong(next, next | MARK_BIT))
+      {
+        //Unlink the node from every level
+        find(key, preds, succs);
+        release(to_remove, guard);
+        return true;
+      }
+    }
+    return false; //Another thread has removed the node
+  }
+
+  bool contains(const T& item)
+  {
+    size_t key = generate_hash(item);
+    EpochDomain::Guard guard(reclamation);
+    Node* previous = head;
+    Node* current = nullptr;
+    size_t steps = 0;
+    for (int level = MAX_LEVEL - 1; level >= 0; --level)
+    {
+      current = get_node(previous->next[level].load(std::memory_order_acquire));
+      while (current)
+      {
+        //Skip removed nodes without helping
+        uintptr_t next = current->next[level].load(std::memory_order_acquire);
+        while (current && is_marked(next))
+        {
+          current = get_node(next);
+          if (current)
+            next = current->next[level].load(std::memory_order_acquire);
+        }
+        if (!current || current->key >= key)
+          break;
+        previous = current;
+        current = get_node(next);
+        ++steps;
+      }
+    }
+    stats.traversal(steps);
+    return current && current->key == key;
+  }
+
+protected:
+  //Copy elements with keys in [lo_key, hi_key] as of one point in time (see snapshot.hpp)
+  void collect(size_t lo_key, size_t hi_key, std::vector<T>& out)
+  {
+    EpochDomain::Guard guard(reclamation);
+    Collector collector = { head, lo_key, hi_key, &out };
+    gate.read(collector);
+  }
+
+public:
+  SetStatistics statistics() const
+  {
+    return stats.get();
+  }
+
+  void reset_statistics()
+  {
+    stats.reset();
+  }
+
+  static void set_error_handler(void(*handler)(const char*))
+  {
+    error_handler = handler;
+  }
+
+private:
+  class Node
+  {
+  public:
+    template <class U>
+    Node(U&& init_value, int init_top_level) : item(std::forward<U>(init_value)), key(std::hash<T>()(item)), top_level(init_top_level),
+      owners(2), next(new std::atomic<uintptr_t>[init_top_level + 1])
+    {
+      for (int i = 0; i <= top_level; ++i)
+        next[i].store(0, std::memory_order_relaxed);
+    }
+
+    ~Node()
+    {
+      delete[] next;
+    }
+
+    T item; //Raw data
+    size_t key; //Data key (hash)
+    int top_level; //Highest level the node is linked at
+    std::atomic<int> owners; //Adder and remover, the last one to finish retires the node
+    std::atomic<uintptr_t>* next; //Pointers to the next nodes by level with a deletion mark in the lowest bit
+  };
+
+  static const uintptr_t MARK_BIT = 1;
+
+  Node* head; //Head of the list
+  SnapshotGate gate; //Consistent snapshots against concurrent modifications
+  EpochDomain reclamation; //Removed nodes reclamation
+  SetStats stats; //Contention statistics (see set_stats.hpp)
+  static void(*error_handler)(const char*); //Fatal errors handler
+
+  static Node* get_node(uintptr_t link)
+  {
+    return reinterpret_cast<Node*>(link & ~MARK_BIT);
+  }
+
+  static bool is_marked(uintptr_t link)
+  {
+    return (link & MARK_BIT) != 0;
+  }
+
+  static uintptr_t make_link(Node* node, bool marked)
+  {
+    return reinterpret_cast<uintptr_t>(node) | (marked ? MARK_BIT : 0);
+  }
+
+  //Walk for the snapshot gate: descend to the first key of the range, then follow the bottom level
+  struct Collector
+  {
+    Node* head; //Head of the list
+    size_t lo_key, hi_key; //Keys range
+    std::vector<T>* out; //Collected elements
+
+    bool operator()()
+    {
+      out->clear();
+      Node* previous = head;
+      for (int level = MAX_LEVEL - 1; level >= 0; --level)
+        for (Node* current = get_node(previous->next[level].load(std::memory_order_acquire));
+          current && current->key < lo_key; current = get_node(current->next[level].load(std::memory_order_acquire)))
+          previous = current;
+      for (Node* current = get_node(previous->next[0].load(std::memory_order_acquire)); current && current->key <= hi_key;
+        current = get_node(current->next[0].load(std::memory_order_acquire)))
+        if (current->key >= lo_key && !is_marked(current->next[0].load(std::memory_order_acquire)))
+          out->push_back(current->item);
+      return true;
+    }
+  };
+
+  static void delete_node(void* node)
+  {
+    delete static_cast<Node*>(node);
+  }
+
+  //Drop ownership of a node: it is retired once both the adder and the remover are done with it
+  void release(Node* node, EpochDomain::Guard& guard)
+  {
+    if (node->owners.fetch_sub(1) == 1)
+    {
+      guard.retire(node, delete_node);
+      stats.add(SetStats::RETIREMENTS);
+    }
+  }
+
+  //Geometric level distribution with p = 1/2
+  static int random_level()
+  {
+    static thread_local uint64_t state = std::hash<std::thread::id>()(std::this_thread::get_id()) | 1;
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    int level = 0;
+    for (uint64_t bits = state; (bits & 1) && level < MAX_LEVEL - 1; bits >>= 1)
+      ++level;
+    return level;
+  }
+
+  //Find predecessors and successors of the key on every level unlinking marked nodes on the way
+  //(true if the key is in the list)
+  bool find(size_t key, Node** preds, Node** succs)
+  {
+    size_t steps = 0;
+    bool restart = true;
+    while (restart)
+    {
+      restart = false;
+      Node* previous = head;
+      for (int level = MAX_LEVEL - 1; level >= 0 && !restart; --level)
+      {
+        Node* current = get_node(previous->next[level].load());
+        while (current)
+        {
+          uintptr_t next = current->next[level].load();
+          //Help to unlink removed nodes
+          while (current && is_marked(next))
+          {
+            uintptr_t expected = make_link(current, false);
+            if (!previous->next[level].compare_exchange_strong(expected, make_link(get_node(next), false)))
+            {
+              stats.add(SetStats::RETRIES);
+              restart = true;
+              break;
+            }
+            current = get_node(next);
+            if (current)
+              next = current->next[level].load();
+          }
+          if (restart || !current || current->key >= key)
+            break;
+          previous = current;
+          current = get_node(next);
+          ++steps;
+        }
+        preds[level] = previous;
+        succs[level] = current;
+      }
+    }
+    stats.traversal(steps);
+    return succs[0] && succs[0]->key == key;
+  }
+
+  //Add an element copied or moved into the new node
+  template <class U>
+  bool insert_item(U&& item)
+  {
+    SnapshotGate::WriteScope write(gate);
+    size_t key = generate_hash(item);
+    int top_level = random_level();
+    Node* preds[MAX_LEVEL];
+    Node* succs[MAX_LEVEL];
+    EpochDomain::Guard guard(reclamation);
+    Node* to_insert = nullptr;
+    while (true)
+    {
+      if (find(key, preds, succs))
+      {
+        if (to_insert)
+        {
+          Set<T>::give_back(std::forward<U>(item), to_insert->item);
+          delete to_insert;
+        }
+        return false;
+      }
+      //The element is moved into the node only once it is known to be absent
+      if (!to_insert)
+      {
+        to_insert = new Node(std::forward<U>(item), top_level);
+        if (!to_insert)
+          error_handler(g_msg_err_node_create);
+        stats.add(SetStats::ALLOCATIONS);
+      }
+      //Link the bottom level first: the node is in the set after that
+      for (int level = 0; level <= top_level; ++level)
+        to_insert->next[level].store(make_link(succs[level], false), std::memory_order_relaxed);
+      uintptr_t expected = make_link(succs[0], false);
+      if (preds[0]->next[0].compare_exchange_strong(expected, make_link(to_insert, false)))
+        break;
+      stats.add(SetStats::RETRIES);
+    }
+
+    //Link upper levels unless the node is being removed
+    for (int level = 1; level <= top_level; ++level)
+    {
+      bool linked = false;
+      while (!linked)
+      {
+        uintptr_t next = to_insert->next[level].load();
+        if (is_marked(next))
+          break;
+        if (get_node(next) != succs[level] && !to_insert->next[level].compare_exchange_strong(next, make_link(succs[level], false)))
+          continue;
+        uintptr_t expected = make_link(succs[level], false);
+        if (preds[level]->next[level].compare_exchange_strong(expected, make_link(to_insert, false)))
+          linked = true;
+        else if (!find(key, preds, succs) || succs[0] != to_insert)
+          break; //The node has been removed meanwhile
+      }
+      if (!linked)
+        break;
+    }
+
+    //A remover could have missed levels linked after its search, unlink them before giving the node away
+    if (is_marked(to_insert->next[0].load()))
+      find(key, preds, succs);
+    release(to_insert, guard);
+    return true;
+  }
+
+  size_t generate_hash(const T& item)
+  {
+    return std::hash<T>()(item);
+  }
+};
+
+template <class T>
+void(*SetSkipList<T>::error_handler)(const char*) = nullptr;
+
+#endif
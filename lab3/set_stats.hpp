@@ -0,0 +1,170 @@
+
+#ifndef SET_STATS_PZLQMA__
+#define SET_STATS_PZLQMA__
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <functional>
+
+//Contention statistics of a set
+struct SetStatistics
+{
+  SetStatistics() : retries(0), lock_acquisitions(0), lock_wait_ns(0), traversals(0), traversal_steps(0),
+    allocations(0), retirements(0) {}
+
+  //Accumulate statistics of another set
+  void add(const SetStatistics& other)
+  {
+    retries += other.retries;
+    lock_acquisitions += other.lock_acquisitions;
+    lock_wait_ns += other.lock_wait_ns;
+    traversals += other.traversals;
+    traversal_steps += other.traversal_steps;
+    allocations += other.allocations;
+    retirements += other.retirements;
+  }
+
+  uint64_t retries; //Attempts restarted after a failed validation or CAS
+  uint64_t lock_acquisitions; //Node locks taken
+  uint64_t lock_wait_ns; //Time spent taking node locks
+  uint64_t traversals; //Searches of a key position
+  uint64_t traversal_steps; //Nodes passed by the searches
+  uint64_t allocations; //Nodes allocated
+  uint64_t retirements; //Nodes unlinked and passed to reclamation
+};
+
+//Statistics counters of a set (Enabled: whether anything is counted)
+//Disabled counters have only empty methods and take no time and no shared memory.
+//With enabled ones every thread adds to its own cache-line padded shard of relaxed counters, the shards are
+//summed on a query, so counting does not make threads of the set share more cache lines.
+template <bool Enabled>
+class BasicSetStats
+{
+public:
+  enum Counter { RETRIES, LOCK_ACQUISITIONS, LOCK_WAIT_NS, TRAVERSALS, TRAVERSAL_STEPS, ALLOCATIONS, RETIREMENTS, COUNTERS };
+
+  static const bool ENABLED = true;
+  static const size_t SHARDS = 16; //Counter shards
+  static const size_t CACHE_LINE = 64; //Padding between shards
+
+  //Measures the time spent taking a lock for the lifetime of the object
+  class LockTiming
+  {
+  public:
+    LockTiming(BasicSetStats& i_stats) : stats(i_stats), begin(std::chrono::steady_clock::now()) {}
+
+    ~LockTiming()
+    {
+      size_t shard = stats.current_shard();
+      stats.shards[shard].counters[LOCK_WAIT_NS].fetch_add(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count(),
+        std::memory_order_relaxed);
+      stats.shards[shard].counters[LOCK_ACQUISITIONS].fetch_add(1, std::memory_order_relaxed);
+    }
+
+  private:
+    LockTiming(const LockTiming&);
+    LockTiming& operator=(const LockTiming&);
+
+    BasicSetStats& stats; //Statistics of the set
+    std::chrono::steady_clock::time_point begin; //Start of the lock acquisition
+  };
+
+  BasicSetStats()
+  {
+    reset();
+  }
+
+  void add(Counter counter, uint64_t value = 1)
+  {
+    shards[current_shard()].counters[counter].fetch_add(value, std::memory_order_relaxed);
+  }
+
+  //Count a search that has passed the given number of nodes
+  void traversal(uint64_t steps)
+  {
+    size_t shard = current_shard();
+    shards[shard].counters[TRAVERSALS].fetch_add(1, std::memory_order_relaxed);
+    shards[shard].counters[TRAVERSAL_STEPS].fetch_add(steps, std::memory_order_relaxed);
+  }
+
+  //Sum of all shards
+  SetStatistics get() const
+  {
+    uint64_t sums[COUNTERS] = { 0 };
+    for (size_t i = 0; i < SHARDS; ++i)
+      for (size_t j = 0; j < COUNTERS; ++j)
+        sums[j] += shards[i].counters[j].load(std::memory_order_relaxed);
+    SetStatistics statistics;
+    statistics.retries = sums[RETRIES];
+    statistics.lock_acquisitions = sums[LOCK_ACQUISITIONS];
+    statistics.lock_wait_ns = sums[LOCK_WAIT_NS];
+    statistics.traversals = sums[TRAVERSALS];
+    statistics.traversal_steps = sums[TRAVERSAL_STEPS];
+    statistics.allocations = sums[ALLOCATIONS];
+    statistics.retirements = sums[RETIREMENTS];
+    return statistics;
+  }
+
+  void reset()
+  {
+    for (size_t i = 0; i < SHARDS; ++i)
+      for (size_t j = 0; j < COUNTERS; ++j)
+        shards[i].counters[j].store(0, std::memory_order_relaxed);
+  }
+
+private:
+  //Counters of one shard
+  struct Shard
+  {
+    std::atomic<uint64_t> counters[COUNTERS]; //Counter values
+    char padding[CACHE_LINE]; //Keep shards in different cache lines
+  };
+
+  Shard shards[SHARDS]; //Counter shards
+
+  static size_t current_shard()
+  {
+    static thread_local size_t shard = std::hash<std::thread::id>()(std::this_thread::get_id()) % SHARDS;
+    return shard;
+  }
+};
+
+//Disabled counters
+template <>
+class BasicSetStats<false>
+{
+public:
+  enum Counter { RETRIES, LOCK_ACQUISITIONS, LOCK_WAIT_NS, TRAVERSALS, TRAVERSAL_STEPS, ALLOCATIONS, RETIREMENTS, COUNTERS };
+
+  static const bool ENABLED = false;
+
+  class LockTiming
+  {
+  public:
+    LockTiming(BasicSetStats&) {}
+  };
+
+  void add(Counter, uint64_t = 1) {}
+
+  void traversal(uint64_t) {}
+
+  SetStatistics get() const
+  {
+    return SetStatistics();
+  }
+
+  void reset() {}
+};
+
+//Statistics counters of the sets, compiled in with -DSET_STATS (make stats)
+#ifdef SET_STATS
+typedef BasicSetStats<true> SetStats;
+#else
+typedef BasicSetStats<false> SetStats;
+#endif
+
+#endif
@@ -0,0 +1,307 @@
+
+#ifndef SET_UNROLLED_KWPMXD__
+#define SET_UNROLLED_KWPMXD__
+
+#include <functional>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <bits/stdc++.h>
+
+#include "set.h"
+#include "snapshot.hpp"
+#include "locks.hpp"
+#include "key_search.hpp"
+
+//Unrolled list set with lock coupling (Lock is a lock policy from locks.hpp, Capacity is elements per node)
+//Every node keeps up to Capacity sorted keys with their elements and is responsible for keys in
+//(high of the previous node, high]. A full node is split in halves, a node that falls below a quarter
+//takes elements from its successor or absorbs it, so a traversal touches one node per block of keys.
+template <class T, class Lock = LockMutex, size_t Capacity = 32>
+class SetUnrolled final : public SetBase<T, SetUnrolled<T, Lock, Capacity> >
+{
+public:
+  static_assert(Capacity >= 8 && Capacity % 4 == 0, "Capacity must be a multiple of 4 not less than 8");
+
+  SetUnrolled()
+  {
+    if (!error_handler) //Error handler needs to be specified before
+      error_handler(g_msg_err_error_handler);
+    //The head is responsible for every key until it is split and is never removed
+    head = new Node(SIZE_MAX);
+    if (!head)
+      error_handler(g_msg_err_node_create);
+  }
+
+  ~SetUnrolled()
+  {
+    //Delete all nodes from the list
+    for (Node *current = head, *next = nullptr; current != nullptr; current = next)
+    {
+      next = current->next;
+      delete current;
+    }
+  }
+
+  bool add(const T& item)
+  {
+    return insert_item(item);
+  }
+
+  bool add(T&& item)
+  {
+    return insert_item(std::move(item));
+  }
+
+  bool remove(const T& item)
+  {
+    SnapshotGate::WriteScope write(gate);
+    size_t key = generate_hash(item);
+    Node* node = locate(key);
+    size_t position = KeySearch::lower_bound(node->keys, node->count, key);
+    if (position == node->count || node->keys[position] != key)
+    {
+      node->unlock();
+      return false;
+    }
+
+    erase(node, position);
+    if (node->count < Capacity / 4 && node->next)
+      rebalance(node);
+    node->unlock();
+    return true;
+  }
+
+  bool contains(const T& item)
+  {
+    size_t key = generate_hash(item);
+    Node* node = locate(key);
+    size_t position = KeySearch::lower_bound(node->keys, node->count, key);
+    //Check the key while the node is still locked
+    bool found = position < node->count && node->keys[position] == key;
+    node->unlock();
+    return found;
+  }
+
+protected:
+  //Copy elements with keys in [lo_key, hi_key] as of one point in time (see snapshot.hpp)
+  void collect(size_t lo_key, size_t hi_key, std::vector<T>& out)
+  {
+    Collector collector = { head, &stats, lo_key, hi_key, &out };
+    gate.read(collector);
+  }
+
+public:
+  SetStatistics statistics() const
+  {
+    return stats.get();
+  }
+
+  void reset_statistics()
+  {
+    stats.reset();
+  }
+
+  static void set_error_handler(void(*handler)(const char*))
+  {
+    error_handler = handler;
+  }
+
+private:
+  class Node
+  {
+  public:
+    Node(size_t init_high) : count(0), high(init_high), next(nullptr)
+    {
+      std::fill(keys, keys + Capacity, SIZE_MAX);
+    }
+
+    size_t keys[Capacity]; //Sorted keys (hashes), unused ones are SIZE_MAX
+    size_t count; //Number of elements
+    size_t high; //Largest key the node is responsible for
+    Node* next; //Pointer to the next node
+    T items[Capacity]; //Raw data in the keys order
+
+    //Lock the node
+    void lock(SetStats& stats)
+    {
+      SetStats::LockTiming timing(stats);
+      if (!node_lock.lock())
+        error_handler(g_msg_err_mutex_lock);
+    }
+
+    //Unlock the node
+    void unlock()
+    {
+      if (!node_lock.unlock())
+        error_handler(g_msg_err_mutex_unlock);
+    }
+
+  private:
+    Lock node_lock; //Node lock (see locks.hpp for policies)
+  };
+
+  Node* head; //Head of the list
+  SnapshotGate gate; //Consistent snapshots against concurrent modifications
+  SetStats stats; //Contention statistics (see set_stats.hpp)
+  static void(*error_handler)(const char*); //Fatal errors handler
+
+  //Walk over the list for the snapshot gate with lock coupling: writers shift elements inside a node,
+  //so every node is copied with its lock held
+  struct Collector
+  {
+    Node* head; //Head of the list
+    SetStats* stats; //Statistics of the set
+    size_t lo_key, hi_key; //Keys range
+    std::vector<T>* out; //Collected elements
+
+    bool operator()()
+    {
+      out->clear();
+      head->lock(*stats);
+      Node* current = head;
+      while (true)
+      {
+        for (size_t i = 0; i < current->count && current->keys[i] <= hi_key; ++i)
+          if (current->keys[i] >= lo_key)
+            out->push_back(current->items[i]);
+        Node* next = current->next;
+        if (current->high >= hi_key || next == nullptr)
+          break;
+        next->lock(*stats);
+        current->unlock();
+        current = next;
+      }
+      current->unlock();
+      return true;
+    }
+  };
+
+  //Find and lock the node responsible for the key with lock coupling
+  Node* locate(size_t key)
+  {
+    head->lock(stats);
+    Node* current = head;
+    size_t steps = 0;
+    while (key > current->high)
+    {
+      ++steps;
+      Node* next = current->next;
+      next->lock(stats);
+      current->unlock();
+      current = next;
+    }
+    stats.traversal(steps);
+    return current;
+  }
+
+  //Insert an element before the position of a node that is not full
+  template <class U>
+  static void insert(Node* node, size_t position, size_t key, U&& item)
+  {
+    memmove(node->keys + position + 1, node->keys + position, (node->count - position) * sizeof(size_t));
+    std::copy_backward(node->items + position, node->items + node->count, node->items + node->count + 1);
+    node->keys[position] = key;
+    node->items[position] = std::forward<U>(item);
+    ++node->count;
+  }
+
+  //Erase the element at the position of a node
+  static void erase(Node* node, size_t position)
+  {
+    memmove(node->keys + position, node->keys + position + 1, (node->count - position - 1) * sizeof(size_t));
+    std::copy(node->items + position + 1, node->items + node->count, node->items + position);
+    node->keys[--node->count] = SIZE_MAX;
+  }
+
+  //Move the upper half of a full locked node to a new node linked after it
+  Node* split(Node* node)
+  {
+    const size_t half = Capacity / 2;
+    Node* right = new Node(node->high);
+    if (!right)
+      error_handler(g_msg_err_node_create);
+    stats.add(SetStats::ALLOCATIONS);
+    memcpy(right->keys, node->keys + half, (Capacity - half) * sizeof(size_t));
+    std::copy(node->items + half, node->items + Capacity, right->items);
+    right->count = Capacity - half;
+    right->next = node->next;
+    std::fill(node->keys + half, node->keys + Capacity, SIZE_MAX);
+    node->count = half;
+    node->high = node->keys[half - 1];
+    node->next = right;
+    return right;
+  }
+
+  //Refill a locked node that has fallen below a quarter from its successor (locked in the traversal order)
+  void rebalance(Node* node)
+  {
+    Node* next = node->next;
+    next->lock(stats);
+    if (node->count + next->count <= Capacity * 3 / 4)
+    {
+      //Absorb the successor: a thread reaches it only with the node locked, so nobody waits for its lock
+      memcpy(node->keys + node->count, next->keys, next->count * sizeof(size_t));
+      std::copy(next->items, next->items + next->count, node->items + node->count);
+      node->count += next->count;
+      node->high = next->high;
+      node->next = next->next;
+      next->unlock();
+      delete next;
+      stats.add(SetStats::RETIREMENTS);
+      return;
+    }
+
+    //Take the smallest elements of the successor so both nodes end up with about the same number
+    size_t moved = (next->count - node->count) / 2;
+    memcpy(node->keys + node->count, next->keys, moved * sizeof(size_t));
+    std::copy(next->items, next->items + moved, node->items + node->count);
+    node->count += moved;
+    node->high = node->keys[node->count - 1];
+    memmove(next->keys, next->keys + moved, (next->count - moved) * sizeof(size_t));
+    std::copy(next->items + moved, next->items + next->count, next->items);
+    std::fill(next->keys + next->count - moved, next->keys + next->count, SIZE_MAX);
+    next->count -= moved;
+    next->unlock();
+  }
+
+  //Add an element copied or moved into the new node
+  template <class U>
+  bool insert_item(U&& item)
+  {
+    SnapshotGate::WriteScope write(gate);
+    size_t key = generate_hash(item);
+    Node* node = locate(key);
+    size_t position = KeySearch::lower_bound(node->keys, node->count, key);
+    if (position < node->count && node->keys[position] == key)
+    {
+      node->unlock();
+      return false;
+    }
+
+    if (node->count == Capacity)
+    {
+      //Nobody can reach the new node without locking the split one first
+      Node* right = split(node);
+      if (key > node->high)
+      {
+        insert(right, position - node->count, key, std::forward<U>(item));
+        node->unlock();
+        return true;
+      }
+    }
+    insert(node, position, key, std::forward<U>(item));
+    node->unlock();
+    return true;
+  }
+
+  size_t generate_hash(const T& item)
+  {
+    return std::hash<T>()(item);
+  }
+};
+
+template <class T, class Lock, size_t Capacity>
+void(*SetUnrolled<T, Lock, Capacity>::error_handler)(const char*) = nullptr;
+
+#endif
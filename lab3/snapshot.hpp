@@ -0,0 +1,169 @@
+
+#ifndef SNAPSHOT_HKXWMC__
+#define SNAPSHOT_HKXWMC__
+
+#include <atomic>
+#include <thread>
+#include <functional>
+#include <sched.h>
+
+#include "epoch.hpp"
+#include "locks.hpp"
+
+//Snapshot gate: lets a reader collect a set's elements as of one point in time
+//Every modification runs inside a critical section of the gate's epoch domain (a store and a fence to the
+//writer's own record, no shared read-modify-write). Only while a reader is registered do writers also count
+//themselves in striped counters (started before, finished after). A reader registers, waits for a grace
+//period so that every writer which missed the registration has finished, and then collects optimistically
+//until no counted modification overlapped the collection, backing off between attempts. Writers are not
+//stopped by readers unless the grace period has taken HOLD_POLLS polls or HOLD_ATTEMPTS collections have
+//failed: then the reader holds off writers that have not started yet until it has collected, so the
+//modifications in flight drain (a writer that keeps failing its own validation finishes once it runs
+//alone) and the snapshot completes under any stream of writes. Held writers wait outside the writers
+//domain, so they never keep a grace period from ending.
+class SnapshotGate
+{
+public:
+  static const size_t STRIPES = 16; //Writer counter stripes
+  static const size_t CACHE_LINE = 64; //Padding between stripes
+  static const size_t UNCOUNTED = STRIPES; //Stripe of a writer that runs while no reader is registered
+  static const size_t HOLD_POLLS = 1024; //Grace period polls after which a reader holds off new writers
+  static const size_t HOLD_ATTEMPTS = 8; //Failed collections after which a reader holds off new writers
+
+  //Modification of the set (writers keep it for the whole add/remove)
+  class WriteScope
+  {
+  public:
+    WriteScope(SnapshotGate& i_gate) : gate(i_gate), guard(i_gate.admit()), stripe(i_gate.enter_write()) {}
+
+    ~WriteScope()
+    {
+      if (stripe != UNCOUNTED)
+        gate.leave_write(stripe);
+    }
+
+  private:
+    WriteScope(const WriteScope&);
+    WriteScope& operator=(const WriteScope&);
+
+    SnapshotGate& gate; //Gate of the set
+    EpochDomain::Guard guard; //Announcement of the modification in the writers domain
+    size_t stripe; //Stripe of the current thread (UNCOUNTED if no reader was registered)
+  };
+
+  SnapshotGate() : readers(0), holds(0)
+  {
+    for (size_t i = 0; i < STRIPES; ++i)
+    {
+      stripes[i].started.store(0, std::memory_order_relaxed);
+      stripes[i].finished.store(0, std::memory_order_relaxed);
+    }
+  }
+
+  //Run collector() until it has collected the elements as of one point in time
+  //(collector clears its output on every call and returns false if it has met an inconsistent state)
+  template <class Collector>
+  void read(Collector& collector)
+  {
+    readers.fetch_add(1);
+    SpinWait backoff;
+    bool holding = false;
+    //Wait until every writer that may have missed the registration has finished
+    size_t target = writers.grace_period();
+    for (size_t poll = 1; !writers.synchronized(target); ++poll)
+    {
+      if (poll == HOLD_POLLS)
+        hold(holding);
+      backoff.wait();
+    }
+    for (size_t attempt = 1; ; ++attempt)
+    {
+      size_t started = 0;
+      if (quiescent(started))
+      {
+        bool collected = collector();
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (collected && started_sum() == started)
+          break;
+      }
+      if (attempt == HOLD_ATTEMPTS)
+        hold(holding);
+      backoff.wait();
+    }
+    if (holding)
+      holds.fetch_sub(1, std::memory_order_release);
+    readers.fetch_sub(1, std::memory_order_release);
+  }
+
+private:
+  //Counters of one stripe
+  struct Stripe
+  {
+    std::atomic<size_t> started; //Modifications started
+    std::atomic<size_t> finished; //Modifications finished
+    char padding[CACHE_LINE]; //Keep stripes in different cache lines
+  };
+
+  Stripe stripes[STRIPES]; //Writer counters
+  EpochDomain writers; //Modifications in progress, counted or not
+  std::atomic<size_t> readers; //Registered readers (writers count themselves only while there are any)
+  std::atomic<size_t> holds; //Readers that keep new writers waiting
+
+  //Hold off new writers until the reader has collected (once per reader)
+  void hold(bool& holding)
+  {
+    if (holding)
+      return;
+    holds.fetch_add(1);
+    holding = true;
+  }
+
+  //Let a writer in once no reader holds off new writers (it waits outside the writers domain)
+  EpochDomain& admit()
+  {
+    for (SpinWait spin; holds.load(std::memory_order_acquire); spin.wait());
+    return writers;
+  }
+
+  //Called inside the writers domain critical section: its fence orders the announcement before the check
+  size_t enter_write()
+  {
+    if (!readers.load(std::memory_order_relaxed))
+      return UNCOUNTED;
+    static thread_local size_t stripe = std::hash<std::thread::id>()(std::this_thread::get_id()) % STRIPES;
+    stripes[stripe].started.fetch_add(1);
+    //Modifications must not become visible before the started counter
+    std::atomic_thread_fence(std::memory_order_release);
+    return stripe;
+  }
+
+  void leave_write(size_t stripe)
+  {
+    stripes[stripe].finished.fetch_add(1, std::memory_order_release);
+  }
+
+  //Check that no modification is in progress and get the number of started ones
+  bool quiescent(size_t& started)
+  {
+    started = 0;
+    bool result = true;
+    for (size_t i = 0; i < STRIPES; ++i)
+    {
+      size_t stripe_started = stripes[i].started.load();
+      if (stripes[i].finished.load(std::memory_order_acquire) != stripe_started)
+        result = false;
+      started += stripe_started;
+    }
+    return result;
+  }
+
+  size_t started_sum()
+  {
+    size_t started = 0;
+    for (size_t i = 0; i < STRIPES; ++i)
+      started += stripes[i].started.load(std::memory_order_relaxed);
+    return started;
+  }
+};
+
+#endif